@@ -9,7 +9,7 @@ void accept_cb(TSNET *tsnet, socket_t client_fd, uint8_t *data, ssize_t data_len
 		return;
 	}
 
-	printf("connected with (%d:%s:%d)\n", client_fd, client.ip, client.port);
+	printf("connected with (%d:%s:%d) on loop %d\n", client_fd, client.ip, client.port, tsnet_get_loop_index(tsnet));
 }
 
 void recv_cb(TSNET *tsnet, socket_t client_fd, uint8_t *data, ssize_t data_len)
@@ -34,18 +34,28 @@ void close_cb(TSNET *tsnet, socket_t client_fd, uint8_t *data, ssize_t data_len)
 int main(int argc, char **argv)
 {
 	TSNET *tsnet = NULL;
+	int nthreads = 1;
+	int type = TSNET_EPOLL;
 
-	if ( argc != 2 ) {
-		fprintf(stderr, "%s (port)\n", argv[0]);
+	if ( argc < 2 || argc > 4 ) {
+		fprintf(stderr, "%s (port) [event loop threads] [epoll | epoll_et | io_uring]\n", argv[0]);
 		return 1;
 	}
 
-	tsnet = tsnet_create(TSNET_EPOLL, 0, 0);
+	if ( argc >= 3 ) nthreads = atoi(argv[2]);
+	if ( argc >= 4 && strcmp(argv[3], "io_uring") == 0 ) type = TSNET_IO_URING;
+
+	tsnet = tsnet_create(type, 0, 0);
 	if ( !tsnet ) {
 		fprintf(stderr, "%s\n", tsnet_get_last_error());
 		goto out;
 	}
 
+	if ( argc >= 4 && strcmp(argv[3], "epoll_et") == 0 && tsnet_set_edge_trigger(tsnet, 1) < 0 ) {
+		fprintf(stderr, "%s\n", tsnet_get_last_error());
+		goto out;
+	}
+
 	if ( tsnet_bind(tsnet, "0.0.0.0", atoi(argv[1])) < 0 ) {
 		fprintf(stderr, "%s\n", tsnet_get_last_error());
 		goto out;
@@ -64,7 +74,7 @@ int main(int argc, char **argv)
 		goto out;
 	}
 
-	if ( tsnet_loop(tsnet) < 0 ) {
+	if ( tsnet_loop_threads(tsnet, nthreads) < 0 ) {
 		fprintf(stderr, "%s\n", tsnet_get_last_error());
 		goto out;
 	}
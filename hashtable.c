@@ -1,218 +1,257 @@
-#include "tsnet_common_inter.h"
-#include "hashtable.h"
-#include "halfsiphash.h"
+#include "hashtable_inter.h"
+#include "tsnet_slab.h"
 
 #define HASHTABLE_START_SIZE 16 /* size must expand << 1 (for hash table index) */
-#define HASHTABLE_DEFAULT_MAX_SIZE (HASHTABLE_START_SIZE << 13) /* 131072 */
-#define HASHTABLE_DEFAULT_BUCKET_LINK 8 /* for use full bucket */
+#define HASHTABLE_DEFAULT_BUCKET_LINK 1 /* average entries per bucket before the table grows */
+#define HASHTABLE_REHASH_STEP 4 /* old buckets migrated by each operation while the table is resized */
 
-static uint8_t ht_halfsiphash_key[8] = {
-  0x8b, 0x04, 0xe0, 0x12, 0xbb, 0x21, 0xae, 0x57
-};
-
-static int ht_insert_inter(HashTable *ht, void *key, size_t key_len, void *value, size_t value_len);
-static int ht_bucket_clear(HashTable *ht);
-static void ht_bucket_clear_inter(HashTableBucket **buckets, size_t buckets_size);
-static int ht_insert(HashTable *ht, const void *key, size_t key_len, const void *value, size_t value_len);
-
-static inline int compare_key(const void *key, size_t key_len, const void *cmp_key, size_t cmp_key_len)
+/* bytes of the key and value copies (HT_BORROW_VALUE: key only) */
+static inline size_t entry_bytes(HashTable *ht, size_t key_len, size_t value_len)
 {
-	if ( key_len == cmp_key_len ) return memcmp(key, cmp_key, key_len);
-
-	return 1; // not same
+	return key_len + 1 + ((ht->flags & HT_BORROW_VALUE) ? 0 : value_len + 1);
 }
 
-static HashTableBucket * get_ht_bucket(HashTable *ht, const void *key, size_t key_len, uint32_t *index)
+/* chained bucket allocation, HT_INLINE buckets keep their copies in data[] however long they are */
+static size_t bucket_size(HashTable *ht, size_t key_len, size_t value_len)
 {
-	uint32_t hash;
-	
-	halfsiphash(key, key_len, ht_halfsiphash_key, (uint8_t *)&hash, sizeof(hash));
-	
-	*index = hash & (ht->curr_buckets_size - 1);
+	size_t size = offsetof(HashTableBucket, data) + entry_bytes(ht, key_len, value_len);
 
-	return ht->buckets[*index];
+	if ( (ht->flags & HT_INLINE) && size > sizeof(HashTableBucket) ) return size;
+
+	return sizeof(HashTableBucket);
 }
 
-static int rearrange_hashtable(HashTable *ht)
+/* null terminated copies of key and value (string keys and values can be used as is)
+ * room: bytes of entry->data that can be used, HT_INLINE copies go there when they fit, else into one allocation */
+int ht_entry_copy(HashTable *ht, HashTableBucket *entry, size_t room, const void *key, size_t key_len, const void *value, size_t value_len)
 {
-	HashTableBucket **old_buckets = NULL, **new_buckets = NULL;
-	size_t old_buckets_size = 0, new_buckets_size = 0, old_bucket_count = 0;
-
-	if ( ht && !ht->rearrange_fail ) {
-		new_buckets_size = ht->curr_buckets_size << 1;
-
-		if ( new_buckets_size > ht->max_buckets_size ) goto fail;
+	size_t bytes = entry_bytes(ht, key_len, value_len);
 
-		if ( !(new_buckets = calloc(new_buckets_size, sizeof(HashTableBucket *))) ) goto fail;
+	memset(entry, 0x00, offsetof(HashTableBucket, data));
+	entry->key_len = key_len;
+	entry->value_len = value_len;
 
-		// backup for restore
-		old_buckets = ht->buckets;
-		old_buckets_size = ht->curr_buckets_size;
-		old_bucket_count = ht->bucket_count;
+	if ( ht->flags & HT_INLINE ) {
+		if ( bytes <= room ) entry->key = entry->data;
+		else if ( !(entry->key = tsnet_slab_alloc(ht->slab, bytes)) ) return -1;
 
-		// set new buckets
-		ht->buckets = new_buckets;
-		ht->curr_buckets_size = new_buckets_size;
-		ht->bucket_count = 0;
+		if ( !(ht->flags & HT_BORROW_VALUE) ) entry->value = (uint8_t *)entry->key + key_len + 1;
+	}
+	else {
+		if ( !(entry->key = tsnet_slab_alloc(ht->slab, key_len + 1)) ) return -1;
 
-		// copy old buckets to new buckets
-		for ( size_t i = 0; i < old_buckets_size; i++ ) {
-			HashTableBucket *bucket = old_buckets[i];
-			for ( ; bucket; bucket = bucket->next ) { // walk to bucket link
-				if ( ht_insert(ht, bucket->key, bucket->key_len, bucket->value, bucket->value_len) < 0 ) goto restore;
-			}
+		if ( !(ht->flags & HT_BORROW_VALUE) && !(entry->value = tsnet_slab_alloc(ht->slab, value_len + 1)) ) {
+			tsnet_slab_free(ht->slab, entry->key, key_len + 1);
+			entry->key = NULL;
+			return -1;
 		}
+	}
 
-		ht_bucket_clear_inter(old_buckets, old_buckets_size);
-		safe_free(old_buckets);
+	memcpy(entry->key, key, key_len);
+	((uint8_t *)entry->key)[key_len] = 0x00;
+
+	// the caller keeps a borrowed value alive (erase_free() can release it)
+	if ( ht->flags & HT_BORROW_VALUE ) entry->value = (void *)value;
+	else {
+		memcpy(entry->value, value, value_len);
+		((uint8_t *)entry->value)[value_len] = 0x00;
 	}
 
 	return 0;
+}
 
-restore:
-	ht->buckets = old_buckets;
-	ht->curr_buckets_size = old_buckets_size;
-	ht->bucket_count = old_bucket_count;
+/* erase: the value is given to erase_free() first */
+void ht_entry_free(HashTable *ht, HashTableBucket *entry, char erase)
+{
+	if ( entry->value && erase && ht->erase_free ) ht->erase_free(entry->value);
+
+	if ( ht->flags & HT_INLINE ) {
+		if ( entry->key != entry->data ) tsnet_slab_free(ht->slab, entry->key, entry_bytes(ht, entry->key_len, entry->value_len));
+	}
+	else {
+		tsnet_slab_free(ht->slab, entry->key, entry->key_len + 1);
+		if ( !(ht->flags & HT_BORROW_VALUE) ) tsnet_slab_free(ht->slab, entry->value, entry->value_len + 1);
+	}
 
-	ht_bucket_clear_inter(new_buckets, new_buckets_size);
+	entry->key = entry->value = NULL;
+}
 
-fail:
-	ht->rearrange_fail = 1;
+/* chain of the old table that can still hold hash (NULL: its bucket is migrated already, or no migration) */
+static HashTableBucket ** get_old_chain(HashTable *ht, uint64_t hash)
+{
+	size_t index;
 
-	return -1;
+	if ( !ht->old_buckets ) return NULL;
+
+	index = hash & (ht->old_buckets_size - 1);
+
+	return index >= ht->rehash_index ? &ht->old_buckets[index] : NULL;
 }
 
-static int ht_insert_inter(HashTable *ht, void *key, size_t key_len, void *value, size_t value_len)
+/* start moving the entries to a table of size buckets, rehash_step() moves them a few buckets at a time */
+static int resize_hashtable(HashTable *ht, size_t size)
 {
-	uint32_t index;
-	HashTableBucket *bucket = get_ht_bucket(ht, key, key_len, &index);
-
-	if ( bucket ) { // insert to bucket link
-		HashTableBucket *bucket_next;
-		
-		if ( !ht->multi_key ) {
-			if ( compare_key(bucket->key, bucket->key_len, key, key_len) == 0 ) {
-				TSNET_SET_ERROR("compare_key() is failed: (errmsg: duplication key)");
-				goto out;
-			}
-		}
-		
-		// move bucket last link
-		size_t bucket_link_count = 0;
-		for ( ; bucket->next; bucket = bucket->next ) {
-			if ( !ht->multi_key ) {
-				if ( compare_key(bucket->key, bucket->key_len, key, key_len) == 0 ) {
-					TSNET_SET_ERROR("compare_key() is failed: (errmsg: duplication key)");
-					goto out;
-				}
-			}
-			bucket_link_count++;
-		}
+	HashTableBucket **buckets;
+
+	if ( !(buckets = calloc(size, sizeof(HashTableBucket *))) ) {
+		TSNET_SET_ERROR("calloc() is failed: (errmsg: %s, errno: %d, size: %lu)", strerror(errno), errno, size * sizeof(HashTableBucket *));
+		return -1;
+	}
+
+	ht->old_buckets = ht->buckets;
+	ht->old_buckets_size = ht->curr_buckets_size;
+	ht->rehash_index = 0;
 
-		if ( !(bucket_next = malloc(sizeof(HashTableBucket))) ) {
-			TSNET_SET_ERROR("malloc() is failed: (errmsg: %s, errno: %d, size: %lu)", strerror(errno), errno, sizeof(HashTableBucket));
-			goto out;
+	ht->buckets = buckets;
+	ht->curr_buckets_size = size;
+
+	return 0;
+}
+
+/* migrate HASHTABLE_REHASH_STEP old buckets (entries are relinked, not copied).
+ * HT_MULTI_KEY: a chain is oldest first, the old entries of a key go in front of the ones inserted since the resize */
+static void rehash_step(HashTable *ht)
+{
+	HashTableBucket *bucket, *bucket_next, *reversed;
+	size_t index, moved = 0, visited = 0;
+
+	if ( !ht->old_buckets ) return;
+
+	// empty buckets are cheap, but a sparse table must not make one operation walk all of them
+	while ( ht->rehash_index < ht->old_buckets_size && moved < HASHTABLE_REHASH_STEP && visited < HASHTABLE_REHASH_STEP * 10 ) {
+		if ( (bucket = ht->old_buckets[ht->rehash_index]) ) moved++;
+
+		// reversed, so pushing each one at the head of its new chain keeps the order
+		for ( reversed = NULL; bucket; bucket = bucket_next ) {
+			bucket_next = bucket->next;
+			bucket->next = reversed;
+			reversed = bucket;
 		}
-		
-		bucket_next->key = key;
-		bucket_next->key_len = key_len;
-		bucket_next->value = value;
-		bucket_next->value_len = value_len;
-		bucket_next->next = NULL;
-		
-		bucket->next = bucket_next;
-
-		// extend hashtable buckets
-		if ( bucket_link_count >= ht->max_bucket_link ) (void)rearrange_hashtable(ht);
-	}
-	else { // insert to new bucket
-		if ( !(bucket = malloc(sizeof(HashTableBucket))) ) {
-			TSNET_SET_ERROR("malloc() is failed: (errmsg: %s, errno: %d, size: %lu)", strerror(errno), errno, sizeof(HashTableBucket));
-			goto out;
+
+		for ( bucket = reversed; bucket; bucket = bucket_next ) {
+			bucket_next = bucket->next;
+
+			index = ht_hash(ht, bucket->key, bucket->key_len) & (ht->curr_buckets_size - 1);
+			bucket->next = ht->buckets[index];
+			ht->buckets[index] = bucket;
 		}
 
-		bucket->key = key;
-		bucket->key_len = key_len;
-		bucket->value = value;
-		bucket->value_len = value_len;
-		bucket->next = NULL;
+		ht->old_buckets[ht->rehash_index++] = NULL;
+		visited++;
+	}
 
-		ht->buckets[index] = bucket;
-		ht->bucket_count++;
+	if ( ht->rehash_index == ht->old_buckets_size ) {
+		safe_free(ht->old_buckets);
+		ht->old_buckets_size = 0;
+		ht->rehash_index = 0;
 	}
+}
 
-	return 0;
+/* grow over max_bucket_link entries per bucket, shrink under 1/8 of it (one migration at a time) */
+static void check_load(HashTable *ht)
+{
+	if ( ht->old_buckets ) return;
 
-out:
-	return -1;
+	if ( ht->size > ht->curr_buckets_size * ht->max_bucket_link ) (void)resize_hashtable(ht, ht->curr_buckets_size << 1);
+	else if ( ht->curr_buckets_size > ht->init_buckets_size && ht->size * 8 < ht->curr_buckets_size * ht->max_bucket_link ) (void)resize_hashtable(ht, ht->curr_buckets_size >> 1);
+}
+
+static HashTableBucket * find_chain(HashTableBucket *bucket, const void *key, size_t key_len)
+{
+	for ( ; bucket; bucket = bucket->next ) {
+		if ( compare_key(bucket->key, bucket->key_len, key, key_len) == 0 ) return bucket;
+	}
+
+	return NULL;
 }
 
 static int ht_insert(HashTable *ht, const void *key, size_t key_len, const void *value, size_t value_len)
 {
-	void *key_copy = NULL, *value_copy = NULL;
+	uint64_t hash;
+	HashTableBucket **chain, *bucket;
+	size_t size;
 
-	if ( !ht || !key || key_len == 0 || !value || value_len == 0 ) {
+	if ( !ht || !key || key_len == 0 || !value || (value_len == 0 && !(ht->flags & HT_BORROW_VALUE)) ) {
 		TSNET_SET_ERROR("invalid argument: (ht = %s, key = %s, key_len = %lu, value = %s, value_len = %lu)", CKNUL(ht), CKNUL(key), key_len, CKNUL(value), value_len);
 		return -1;
 	}
-	
-	key_copy = calloc(1, key_len + 1);
-	if ( !key_copy ) {
-		TSNET_SET_ERROR("calloc() is failed: (errmsg: %s, errno: %d, size: %lu)", strerror(errno), errno, key_len + 1);
-		goto out;
-	}
-	value_copy = calloc(1, value_len + 1);
-	if ( !value_copy ) {
-		TSNET_SET_ERROR("calloc() is failed: (errmsg: %s, errno: %d, size: %lu)", strerror(errno), errno, value_len + 1);
-		goto out;
+
+	rehash_step(ht);
+
+	hash = ht_hash(ht, key, key_len);
+	chain = &ht->buckets[hash & (ht->curr_buckets_size - 1)];
+
+	if ( !ht->multi_key ) {
+		HashTableBucket **old_chain = get_old_chain(ht, hash);
+
+		if ( find_chain(*chain, key, key_len) || (old_chain && find_chain(*old_chain, key, key_len)) ) {
+			TSNET_SET_ERROR("compare_key() is failed: (errmsg: duplication key)");
+			return -1;
+		}
 	}
-	memcpy(key_copy, key, key_len);
-	memcpy(value_copy, value, value_len);
 
-	if ( ht_insert_inter(ht, key_copy, key_len, value_copy, value_len) < 0 ) goto out;
+	size = bucket_size(ht, key_len, value_len);
+	if ( !(bucket = tsnet_slab_alloc(ht->slab, size)) ) return -1;
 
-	return 0;
+	if ( ht_entry_copy(ht, bucket, size - offsetof(HashTableBucket, data), key, key_len, value, value_len) < 0 ) {
+		tsnet_slab_free(ht->slab, bucket, size);
+		return -1;
+	}
 
-out:
-	safe_free(key_copy);
-	safe_free(value_copy);
+	// appended: HT_MULTI_KEY find() and erase() take the oldest entry of a key
+	while ( *chain ) chain = &(*chain)->next;
+	bucket->next = NULL;
+	*chain = bucket;
+	ht->size++;
+
+	check_load(ht);
 
-	return -1;
+	return 0;
 }
 
-static int ht_erase(HashTable *ht, const void *key, size_t key_len, int8_t multi_key_erase)
+static int erase_chain(HashTable *ht, HashTableBucket **chain, const void *key, size_t key_len, int8_t multi_key_erase)
 {
-	int8_t erased = 0;
-	uint32_t index;
-	HashTableBucket *bucket, *bucket_prev = NULL, *bucket_next;
+	int erased = 0;
+	HashTableBucket *bucket;
 
-	bucket = get_ht_bucket(ht, key, key_len, &index);
+	while ( (bucket = *chain) ) {
+		if ( compare_key(bucket->key, bucket->key_len, key, key_len) != 0 ) {
+			chain = &bucket->next;
+			continue;
+		}
 
-	for ( ; bucket; bucket = bucket_next ) { // walk to bucket link
-		bucket_next = bucket->next;
+		*chain = bucket->next;
 
-		if ( compare_key(bucket->key, bucket->key_len, key, key_len) == 0 ) {
-			if ( ht->buckets[index]->next == NULL ) ht->bucket_count--;
+		ht_entry_free(ht, bucket, 1);
+		tsnet_slab_free(ht->slab, bucket, bucket_size(ht, bucket->key_len, bucket->value_len));
+		ht->size--;
 
-			if ( ht->buckets[index] == bucket ) ht->buckets[index] = bucket->next;
-			else bucket_prev->next = bucket->next;
+		erased++;
+		if ( !multi_key_erase ) break;
+	}
 
-			safe_free(bucket->key);
-			if ( ht->erase_free ) ht->erase_free(bucket->value);
-			safe_free(bucket->value);
-			safe_free(bucket);
+	return erased;
+}
 
-			erased = 1;
-			if ( !multi_key_erase ) break;
-		}
+static int ht_erase(HashTable *ht, const void *key, size_t key_len, int8_t multi_key_erase)
+{
+	int erased;
+	uint64_t hash;
+	HashTableBucket **old_chain;
 
-		bucket_prev = bucket;
-	}
+	rehash_step(ht);
+
+	hash = ht_hash(ht, key, key_len);
+	erased = (old_chain = get_old_chain(ht, hash)) ? erase_chain(ht, old_chain, key, key_len, multi_key_erase) : 0; // the oldest first
+
+	if ( !erased || multi_key_erase ) erased += erase_chain(ht, &ht->buckets[hash & (ht->curr_buckets_size - 1)], key, key_len, multi_key_erase);
+
+	if ( erased ) check_load(ht);
 
 	return erased ? 0 /* erased */ : -1; /* cant found */
 }
 
-static void ht_bucket_clear_inter(HashTableBucket **buckets, size_t buckets_size)
+static void ht_bucket_clear_inter(HashTable *ht, HashTableBucket **buckets, size_t buckets_size)
 {
 	HashTableBucket *bucket, *bucket_next;
 
@@ -221,83 +260,198 @@ static void ht_bucket_clear_inter(HashTableBucket **buckets, size_t buckets_size
 		while ( bucket ) {
 			bucket_next = bucket->next;
 
-			safe_free(bucket->key);
-			safe_free(bucket->value);
-			safe_free(bucket);
+			ht_entry_free(ht, bucket, 0);
+			tsnet_slab_free(ht->slab, bucket, bucket_size(ht, bucket->key_len, bucket->value_len));
 
 			bucket = bucket_next;
 		}
 	}
 }
 
+/* the table goes back to its initial size */
 static int ht_bucket_clear(HashTable *ht)
 {
+	HashTableBucket **buckets;
+
 	if ( !ht || !ht->buckets ) return -1;
 
-	ht_bucket_clear_inter(ht->buckets, ht->curr_buckets_size);
+	ht_bucket_clear_inter(ht, ht->buckets, ht->curr_buckets_size);
+	if ( ht->old_buckets ) ht_bucket_clear_inter(ht, ht->old_buckets, ht->old_buckets_size);
 
-	memset(ht->buckets, 0x00, sizeof(HashTableBucket *) * ht->curr_buckets_size);
+	safe_free(ht->old_buckets);
+	ht->old_buckets_size = 0;
+	ht->rehash_index = 0;
+	ht->size = 0;
 
-	ht->bucket_count = 0;
+	if ( ht->curr_buckets_size > ht->init_buckets_size && (buckets = calloc(ht->init_buckets_size, sizeof(HashTableBucket *))) ) {
+		free(ht->buckets);
+		ht->buckets = buckets;
+		ht->curr_buckets_size = ht->init_buckets_size;
+	}
+	else memset(ht->buckets, 0x00, sizeof(HashTableBucket *) * ht->curr_buckets_size);
 
 	return 0;
 }
 
+static HashTableBucket * find_hashed(HashTable *ht, uint64_t hash, const void *key, size_t key_len)
+{
+	HashTableBucket *bucket, **old_chain;
+
+	// entries not migrated yet are older than the ones in the new chain
+	if ( (old_chain = get_old_chain(ht, hash)) && (bucket = find_chain(*old_chain, key, key_len)) ) return bucket;
+
+	return find_chain(ht->buckets[hash & (ht->curr_buckets_size - 1)], key, key_len);
+}
+
 static HashTableBucket * ht_find(HashTable *ht, const void *key, size_t key_len)
 {
-	HashTableBucket *bucket;
-	uint32_t index;
+	rehash_step(ht);
+
+	return find_hashed(ht, ht_hash(ht, key, key_len), key, key_len);
+}
+
+/* up to HT_FIND_BATCH keys: bucket heads, first nodes and their keys are prefetched a pass ahead of the lookups */
+static size_t find_batch(HashTable *ht, const void * const *keys, const size_t *lens, size_t n, HashTableBucket **out)
+{
+	uint64_t hash[HT_FIND_BATCH];
+	HashTableBucket *head[HT_FIND_BATCH];
+	size_t found = 0;
+
+	PANIC(n <= HT_FIND_BATCH);
+
+	rehash_step(ht);
+
+	for ( size_t i = 0; i < n; i++ ) {
+		hash[i] = ht_hash(ht, keys[i], lens[i]);
+		__builtin_prefetch(&ht->buckets[hash[i] & (ht->curr_buckets_size - 1)]);
+	}
+
+	for ( size_t i = 0; i < n; i++ ) {
+		if ( (head[i] = ht->buckets[hash[i] & (ht->curr_buckets_size - 1)]) ) __builtin_prefetch(head[i]);
+	}
+
+	// HT_INLINE keys are in the node already
+	if ( !(ht->flags & HT_INLINE) ) {
+		for ( size_t i = 0; i < n; i++ ) {
+			if ( head[i] ) __builtin_prefetch(head[i]->key);
+		}
+	}
 
-	bucket = get_ht_bucket(ht, key, key_len, &index);
+	for ( size_t i = 0; i < n; i++ ) {
+		if ( (out[i] = find_hashed(ht, hash[i], keys[i], lens[i])) ) found++;
+	}
+
+	return found;
+}
+
+static int count_chain(HashTableBucket *bucket, const void *key, size_t key_len)
+{
+	int count = 0;
 
 	for ( ; bucket; bucket = bucket->next ) {
-		if ( compare_key(bucket->key, bucket->key_len, key, key_len) == 0 ) return bucket;
+		if ( compare_key(bucket->key, bucket->key_len, key, key_len) == 0 ) count++;
 	}
 
-	return NULL;
+	return count;
 }
 
 static int ht_count(HashTable *ht, const void *key, size_t key_len)
 {
 	int count;
-	HashTableBucket *bucket;
-	uint32_t index;
+	uint64_t hash;
+	HashTableBucket **old_chain;
 
-	bucket = get_ht_bucket(ht, key, key_len, &index);
+	rehash_step(ht);
 
-	for ( count = 0; bucket; bucket = bucket->next ) {
-		if ( compare_key(bucket->key, bucket->key_len, key, key_len) == 0 ) count++;
-	}
+	hash = ht_hash(ht, key, key_len);
+	count = count_chain(ht->buckets[hash & (ht->curr_buckets_size - 1)], key, key_len);
+	if ( (old_chain = get_old_chain(ht, hash)) ) count += count_chain(*old_chain, key, key_len);
 
 	return count;
 }
 
 static int ht_empty(HashTable *ht, const void *key, size_t key_len)
 {
-	return ht_count(ht, key, key_len) > 0 ? 0 /* not empty */ : 1 /* empty */;
+	return ht_find(ht, key, key_len) ? 0 /* not empty */ : 1 /* empty */;
 }
 
-HashTable * ht_create(size_t max_buckets_size, size_t max_bucket_link, char multi_key)
+struct tsnet_slab * ht_slab_create(char huge)
+{
+	struct tsnet_slab *slab;
+
+	if ( !(slab = calloc(1, sizeof(struct tsnet_slab))) ) {
+		TSNET_SET_ERROR("calloc() is failed: (errmsg: %s, errno: %d, size: %lu)", strerror(errno), errno, sizeof(struct tsnet_slab));
+		return NULL;
+	}
+
+	if ( tsnet_slab_init(slab, huge) < 0 ) {
+		free(slab);
+		return NULL;
+	}
+
+	return slab;
+}
+
+void ht_slab_delete(struct tsnet_slab *slab)
+{
+	if ( slab ) {
+		tsnet_slab_clear(slab);
+		free(slab);
+	}
+}
+
+HashTable * ht_create(size_t init_size, size_t max_bucket_link, int flags, hashtable_hash_func hash)
+{
+	return ht_create_slab(init_size, max_bucket_link, flags, hash, NULL);
+}
+
+HashTable * ht_create_slab(size_t init_size, size_t max_bucket_link, int flags, hashtable_hash_func hash, struct tsnet_slab *slab)
 {
 	HashTable *ht = NULL;
+	size_t size = HASHTABLE_START_SIZE;
+
+	if ( slab && (flags & HT_CONCURRENT) ) {
+		TSNET_SET_ERROR("invalid argument: (errmsg: HT_CONCURRENT shards have their own slabs, a shared slab is single threaded)");
+		return NULL;
+	}
 
 	if ( !(ht = calloc(1, sizeof(HashTable))) ) goto out;
 
-	ht->curr_buckets_size = HASHTABLE_START_SIZE;
+	if ( slab ) ht->slab = slab;
+	else if ( !(ht->slab = ht_slab_create(0)) ) goto out;
+	else ht->own_slab = 1;
+
+	ht->flags = flags;
+	ht->hash = hash ? hash : ht_hash_default;
+	ht->seed = ht_hash_seed();
+	ht->multi_key = (flags & HT_MULTI_KEY) ? 1 : 0;
+
+	if ( (flags & HT_CONCURRENT) && (flags & HT_OPEN_ADDRESSING) ) {
+		TSNET_SET_ERROR("invalid argument: (errmsg: HT_CONCURRENT is not supported by HT_OPEN_ADDRESSING)");
+		goto out;
+	}
+
+	if ( flags & HT_OPEN_ADDRESSING ) {
+		if ( ht_swiss_init(ht, init_size) < 0 ) goto out;
+		return ht;
+	}
+
+	if ( flags & HT_CONCURRENT ) {
+		if ( ht_concurrent_init(ht, init_size, max_bucket_link) < 0 ) goto out;
+		return ht;
+	}
+
+	for ( ; size < init_size; size = size << 1 ) {/* no action */}
+
+	ht->init_buckets_size = ht->curr_buckets_size = size;
 	if ( !(ht->buckets = calloc(ht->curr_buckets_size, sizeof(HashTableBucket *))) ) {
-		TSNET_SET_ERROR("calloc() is failed: (errmsg: %s, errno: %d, size: %lu)", strerror(errno), errno, ht->curr_buckets_size * sizeof(HashTableBucket));
+		TSNET_SET_ERROR("calloc() is failed: (errmsg: %s, errno: %d, size: %lu)", strerror(errno), errno, ht->curr_buckets_size * sizeof(HashTableBucket *));
 		goto out;
 	}
-	
-	size_t size = HASHTABLE_START_SIZE;
-	for ( ; size < max_buckets_size; size = size << 1 ) {/* no action */}
-	ht->max_buckets_size = size;
 
 	if ( max_bucket_link == 0 ) ht->max_bucket_link = HASHTABLE_DEFAULT_BUCKET_LINK;
 	else ht->max_bucket_link = max_bucket_link;
 
-	ht->multi_key = multi_key;
-	
 	ht->insert = ht_insert;
 	ht->erase = ht_erase;
 	ht->clear = ht_bucket_clear;
@@ -318,21 +472,80 @@ void ht_set_erase_free(HashTable *ht, hashtable_erase_free erase_free)
 	if ( ht && erase_free ) ht->erase_free = erase_free;
 }
 
+int ht_set_huge_pages(HashTable *ht, char enable)
+{
+	if ( !ht ) {
+		TSNET_SET_ERROR("invalid argument: (ht = %s)", CKNUL(ht));
+		return -1;
+	}
+
+	if ( ht->flags & HT_CONCURRENT ) return ht_concurrent_huge_pages(ht, enable);
+
+	if ( !ht->own_slab ) {
+		TSNET_SET_ERROR("the slab is shared: (ht_slab_create() makes it with huge pages)");
+		return -1;
+	}
+
+	return tsnet_slab_init(ht->slab, enable);
+}
+
+int ht_get_slab_stats(HashTable *ht, struct tsnet_slab_stats *stats)
+{
+	if ( !ht || !stats ) {
+		TSNET_SET_ERROR("invalid argument: (ht = %s, stats = %s)", CKNUL(ht), CKNUL(stats));
+		return -1;
+	}
+
+	if ( ht->flags & HT_CONCURRENT ) ht_concurrent_slab_stats(ht, stats);
+	else tsnet_slab_stats(ht->slab, stats);
+
+	return 0;
+}
+
 void ht_delete(HashTable *ht)
 {
 	if ( ht ) {
-		ht_bucket_clear(ht);
+		if ( ht->flags & HT_OPEN_ADDRESSING ) ht_swiss_release(ht);
+		else if ( ht->flags & HT_CONCURRENT ) ht_concurrent_release(ht);
+		else ht_bucket_clear(ht);
 		safe_free(ht->buckets);
+		safe_free(ht->old_buckets);
+		// a shared slab got every object back from the clear above
+		if ( ht->own_slab ) ht_slab_delete(ht->slab);
 		safe_free(ht);
 	}
 }
 
+/* out[i]: find() of keys[i], the memory latency of the lookups overlaps. returns the found count */
+ssize_t ht_find_batch(HashTable *ht, const void * const *keys, const size_t *lens, size_t n, HashTableBucket **out)
+{
+	size_t found = 0, count;
+
+	if ( !ht || (n > 0 && (!keys || !lens || !out)) ) {
+		TSNET_SET_ERROR("invalid argument: (ht = %s, keys = %s, lens = %s, n = %lu, out = %s)", CKNUL(ht), CKNUL(keys), CKNUL(lens), n, CKNUL(out));
+		return -1;
+	}
+
+	if ( ht->flags & HT_OPEN_ADDRESSING ) return ht_swiss_find_batch(ht, keys, lens, n, out);
+	if ( ht->flags & HT_CONCURRENT ) return ht_concurrent_find_batch(ht, keys, lens, n, out);
+
+	// the stack arrays of find_batch() hold HT_FIND_BATCH keys
+	for ( size_t i = 0; i < n; i += count ) {
+		count = n - i < HT_FIND_BATCH ? n - i : HT_FIND_BATCH;
+		found += find_batch(ht, keys + i, lens + i, count, out + i);
+	}
+
+	return found;
+}
+
 void ht_dump(HashTable *ht, char detail)
 {
-	if ( ht ) {
+	if ( ht && (ht->flags & HT_OPEN_ADDRESSING) ) ht_swiss_dump(ht, detail);
+	else if ( ht && (ht->flags & HT_CONCURRENT) ) ht_concurrent_dump(ht, detail);
+	else if ( ht ) {
 		printf("curr_buckets_size:       %lu\n", ht->curr_buckets_size);
-		printf("max_buckets_size:        %lu\n", ht->max_buckets_size);
-		printf("bucket_count:            %lu\n", ht->bucket_count);
+		printf("old_buckets_size:        %lu (migrated: %lu)\n", ht->old_buckets_size, ht->rehash_index);
+		printf("size:                    %lu\n", ht->size);
 		if ( detail ) {
 			for ( size_t i = 0; i < ht->curr_buckets_size; i++ ) {
 				size_t bucket_link_count = 0;
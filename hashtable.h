@@ -1,5 +1,18 @@
 #pragma once
 
+struct tsnet_slab;
+struct tsnet_slab_stats;
+struct ht_shard;
+
+/* ht_create() flags */
+#define HT_MULTI_KEY 0x01 /* the same key can be inserted more than once: find() / erase(..., 0) take the oldest (HT_OPEN_ADDRESSING: any one of them) */
+#define HT_OPEN_ADDRESSING 0x02 /* open addressing (swiss table) engine, max_bucket_link is not used */
+#define HT_INLINE 0x04 /* key and value copies are kept in the entry (open addressing: up to HT_INLINE_SIZE bytes, else one allocation) */
+#define HT_BORROW_VALUE 0x08 /* value pointer is stored as given (not copied, not freed, erase_free() is still called) */
+#define HT_CONCURRENT 0x10 /* thread safe: lock striped shards for writers, lock free find() (see ht_read_lock()), not with HT_OPEN_ADDRESSING */
+
+#define HT_INLINE_SIZE 16 /* key + value + 2 null bytes kept in an open addressing slot */
+
 typedef struct hash_table HashTable;
 typedef struct hash_table_bucket HashTableBucket;
 
@@ -9,25 +22,47 @@ typedef int (*hashtable_erase_func)(HashTable *ht, const void *key, size_t key_l
 typedef int (*hashtable_key_func)(HashTable *ht, const void *key, size_t key_len);
 typedef int (*hashtable_func)(HashTable *ht);
 typedef void (*hashtable_erase_free)(void *data);
+typedef uint64_t (*hashtable_hash_func)(const void *key, size_t key_len, uint64_t seed);
 
 typedef struct hash_table_bucket {
 	void *key, *value;
 	size_t key_len, value_len;
-	HashTableBucket *next;
+	HashTableBucket *next; // HT_OPEN_ADDRESSING: always NULL
+	uint8_t data[HT_INLINE_SIZE]; // HT_INLINE: key, 0x00, value, 0x00 (a chained bucket is allocated as long as it needs)
 } HashTableBucket;
 
 typedef struct hash_table {
 	/* private */
 	HashTableBucket **buckets;
 	size_t curr_buckets_size; // current hash table max bucket count
-	size_t max_buckets_size;  // maximum hash table bucket count
-	size_t max_bucket_link; // bucket link count by each bucket (for autoscale hash table)
-	size_t bucket_count; // used bucket count
+	size_t init_buckets_size; // the table does not shrink under it
+	size_t max_bucket_link; // average bucket link count (load factor) before the table grows
+
+	/* while resizing, old_buckets[rehash_index ~] are not migrated yet (a few buckets are moved by each operation) */
+	HashTableBucket **old_buckets;
+	size_t old_buckets_size, rehash_index;
 
-	char rearrange_fail;
 	char multi_key;
+	int flags; // ht_create() flags
+	size_t size; // entries
+
+	/* HT_OPEN_ADDRESSING (hashtable_swiss.c) */
+	int8_t *ctrl; // per slot: empty, deleted or 7 bits of the hash (the first group is mirrored after the end)
+	HashTableBucket *slots; // entries are stored in the table, find() returns a slot (valid until the next insert or erase)
+	size_t capacity, init_capacity, growth_left; // growth_left: empty slots that can be used before the table grows
+	int8_t *old_ctrl; // while resizing, old slots rehash_index ~ are not migrated yet
+	HashTableBucket *old_slots;
+	size_t old_capacity;
+
+	/* HT_CONCURRENT (hashtable_concurrent.c) */
+	struct ht_shard *shards; // a writer locks the shard of its key, size is updated atomically
 
 	hashtable_erase_free erase_free;
+	hashtable_hash_func hash;
+	uint64_t seed; // per process random (ht_hash_seed())
+
+	struct tsnet_slab *slab; // buckets, key and value copies
+	char own_slab; // made by ht_create() (ht_create_slab(): the caller's, shared with other tables)
 
 	/* public */
 	hashtable_insert_func insert;
@@ -38,8 +73,29 @@ typedef struct hash_table {
 	hashtable_key_func empty;
 } HashTable;
 
-HashTable * ht_create(size_t max_size /* It is changed to an approximate value. (2^n) */, size_t max_bucket_link, char multi_key);
+HashTable * ht_create(size_t init_size /* initial buckets (slots), changed to 2^n. The table grows and shrinks with its load */, size_t max_bucket_link /* 0: 1 */, int flags /* HT_* */, hashtable_hash_func hash /* NULL: ht_hash_default */);
+/* many small tables: one slab for all of them (each table of ht_create() maps its own slabs, one per size class in use).
+ * the slab is used by one thread at a time and outlives its tables (not HT_CONCURRENT) */
+HashTable * ht_create_slab(size_t init_size, size_t max_bucket_link, int flags, hashtable_hash_func hash, struct tsnet_slab *slab /* NULL: ht_create() */);
+struct tsnet_slab * ht_slab_create(char huge);
+void ht_slab_delete(struct tsnet_slab *slab); /* after its tables */
+
 void ht_set_erase_free(HashTable *ht, hashtable_erase_free erase_free);
+int ht_set_huge_pages(HashTable *ht, char enable); /* only while the table is empty, not with a shared slab */
+int ht_get_slab_stats(HashTable *ht, struct tsnet_slab_stats *stats);
 void ht_delete(HashTable *ht);
 
+/* HT_CONCURRENT: find() and ht_find_batch() fail outside a read section, a bucket stays valid until its ht_read_unlock().
+ * sections nest and cost two stores, erased entries (and erase_free()) wait for the sections open at the time */
+int ht_read_lock(void);
+void ht_read_unlock(void);
+
+ssize_t ht_find_batch(HashTable *ht, const void * const *keys, const size_t *lens, size_t n, HashTableBucket **out /* n entries, NULL: not found */);
+
 void ht_dump(HashTable *ht, char detail);
+
+/* hash functions for ht_create() (seed: the per process random seed of the table) */
+uint64_t ht_hash_default(const void *key, size_t key_len, uint64_t seed); /* 4 / 8 byte keys: integer mix, others: ht_hash_wyhash() */
+uint64_t ht_hash_wyhash(const void *key, size_t key_len, uint64_t seed);
+uint64_t ht_hash_halfsiphash(const void *key, size_t key_len, uint64_t seed); /* slower, the former hash of HashTable */
+uint64_t ht_hash_seed(void);
@@ -0,0 +1,779 @@
+#include <pthread.h>
+#include <sched.h>
+
+#include "hashtable_inter.h"
+#include "tsnet_slab.h"
+
+#define HT_SHARD_BITS 6 /* 64 lock stripes */
+#define HT_SHARD_START_SIZE 16 /* buckets of a shard, power of two */
+#define HT_CACHE_LINE 64
+#define HT_RECLAIM_BATCH 64 /* retired records of a shard before a writer scans the readers anyway */
+#define HT_MIGRATE_STEP 4 /* old chains copied by each write while a shard is resized */
+
+/*
+ * HT_CONCURRENT
+ * writers lock the shard of the key (top bits of the hash), readers take no lock and only load published pointers.
+ * only the next pointer of a linked node changes (insert appends at the tail, erase unlinks): an erased node is retired, a resize links copies into a new bucket array a few chains per write.
+ * find() returns a node, so it must be called in the caller's read section (count() and empty() open their own).
+ * retired memory is freed once every thread that could see it has left its read section (epoch based reclamation).
+ */
+
+/* a bucket array, replaced as a whole by a resize */
+struct ht_cbuckets {
+	struct ht_cbuckets *old; // still being moved into this one (readers search its chain first)
+	size_t size;
+	HashTableBucket *b[];
+};
+
+/* unlinked memory kept until no reader can hold it */
+struct ht_retired {
+	struct ht_retired *next;
+	uint64_t epoch; // global epoch when it was unlinked
+	void *ptr;
+	size_t size;
+	char bucket; // a node (else a bucket array)
+	char erase; // a node removed by erase(), its value is given to erase_free()
+};
+
+struct ht_shard {
+	pthread_mutex_t lock; // writers of the shard
+	struct ht_cbuckets *buckets; // stored with release, readers load with acquire
+	size_t size, init_size;
+	size_t migrate; // chains of buckets->old before it are moved (and cut)
+	struct ht_retired *retired, *retired_tail; // oldest first
+	size_t retired_count;
+	struct tsnet_slab slab; // nodes, bucket arrays and retire records of the shard (used under lock)
+} __attribute__((aligned(HT_CACHE_LINE)));
+
+/* a thread that used ht_read_lock(), records are reused after their thread exits */
+struct ht_reader {
+	uint64_t state; // epoch << 1 | 1 while in a read section, 0 outside
+	struct ht_reader *next;
+	int nest;
+	char used;
+} __attribute__((aligned(HT_CACHE_LINE)));
+
+static uint64_t ht_epoch = 1;
+static struct ht_reader *ht_readers; // only prepended (writers scan it without a lock)
+static pthread_mutex_t ht_readers_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t ht_reader_key;
+static pthread_once_t ht_reader_once = PTHREAD_ONCE_INIT;
+static __thread struct ht_reader *ht_self;
+
+static void reader_exit(void *arg)
+{
+	struct ht_reader *reader = arg;
+
+	__atomic_store_n(&reader->state, 0, __ATOMIC_RELEASE);
+	__atomic_store_n(&reader->used, 0, __ATOMIC_RELEASE);
+}
+
+static void reader_key_create(void)
+{
+	(void)pthread_key_create(&ht_reader_key, reader_exit);
+}
+
+static struct ht_reader * reader_get(void)
+{
+	struct ht_reader *reader;
+
+	if ( ht_self ) return ht_self;
+
+	pthread_once(&ht_reader_once, reader_key_create);
+	pthread_mutex_lock(&ht_readers_lock);
+
+	for ( reader = ht_readers; reader; reader = reader->next ) {
+		if ( !reader->used ) break;
+	}
+
+	if ( !reader ) {
+		if ( posix_memalign((void **)&reader, HT_CACHE_LINE, sizeof(struct ht_reader)) != 0 ) {
+			pthread_mutex_unlock(&ht_readers_lock);
+			TSNET_SET_ERROR("posix_memalign() is failed: (size: %lu)", sizeof(struct ht_reader));
+			return NULL;
+		}
+
+		memset(reader, 0x00, sizeof(struct ht_reader));
+		reader->next = ht_readers;
+		__atomic_store_n(&ht_readers, reader, __ATOMIC_RELEASE);
+	}
+
+	reader->used = 1;
+	reader->nest = 0;
+	pthread_mutex_unlock(&ht_readers_lock);
+
+	pthread_setspecific(ht_reader_key, reader);
+
+	return ht_self = reader;
+}
+
+int ht_read_lock(void)
+{
+	struct ht_reader *reader;
+
+	if ( !(reader = reader_get()) ) return -1;
+
+	if ( reader->nest++ == 0 ) {
+		__atomic_store_n(&reader->state, (__atomic_load_n(&ht_epoch, __ATOMIC_RELAXED) << 1) | 1, __ATOMIC_RELAXED);
+		// the epoch is announced before any node is loaded
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	}
+
+	return 0;
+}
+
+void ht_read_unlock(void)
+{
+	struct ht_reader *reader = ht_self;
+
+	if ( reader && reader->nest > 0 && --reader->nest == 0 ) __atomic_store_n(&reader->state, 0, __ATOMIC_RELEASE);
+}
+
+/* the epoch moves on when every reader in a read section has seen the current one */
+static uint64_t epoch_advance(void)
+{
+	uint64_t epoch, state;
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	epoch = __atomic_load_n(&ht_epoch, __ATOMIC_ACQUIRE);
+
+	for ( struct ht_reader *reader = __atomic_load_n(&ht_readers, __ATOMIC_ACQUIRE); reader; reader = reader->next ) {
+		state = __atomic_load_n(&reader->state, __ATOMIC_ACQUIRE);
+		if ( (state & 1) && (state >> 1) != epoch ) return epoch;
+	}
+
+	if ( __atomic_compare_exchange_n(&ht_epoch, &epoch, epoch + 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) ) return epoch + 1;
+
+	return epoch; // advanced by another writer
+}
+
+static inline size_t node_size(HashTable *ht, size_t key_len, size_t value_len)
+{
+	return offsetof(HashTableBucket, data) + key_len + 1 + ((ht->flags & HT_BORROW_VALUE) ? 0 : value_len + 1);
+}
+
+static inline struct ht_shard * shard_of(HashTable *ht, uint64_t hash)
+{
+	return &ht->shards[hash >> (64 - HT_SHARD_BITS)];
+}
+
+static inline HashTableBucket ** chain_of(struct ht_cbuckets *buckets, uint64_t hash)
+{
+	return &buckets->b[hash & (buckets->size - 1)];
+}
+
+static void free_retired(HashTable *ht, struct ht_shard *shard, struct ht_retired *retired)
+{
+	HashTableBucket *node = retired->ptr;
+
+	if ( retired->bucket && retired->erase && ht->erase_free ) ht->erase_free(node->value);
+	tsnet_slab_free(&shard->slab, retired->ptr, retired->size);
+	tsnet_slab_free(&shard->slab, retired, sizeof(struct ht_retired));
+}
+
+/* frees what was retired two epochs ago (no reader can still be in a section that saw it) */
+static void reclaim(HashTable *ht, struct ht_shard *shard)
+{
+	struct ht_retired *retired;
+	uint64_t epoch;
+
+	if ( !shard->retired ) return;
+
+	// the readers are scanned when one advance frees the oldest record, or too many records are waiting
+	epoch = __atomic_load_n(&ht_epoch, __ATOMIC_ACQUIRE);
+	if ( shard->retired->epoch + 2 > epoch ) {
+		if ( shard->retired_count < HT_RECLAIM_BATCH && shard->retired->epoch >= epoch ) return;
+		epoch = epoch_advance();
+	}
+
+	while ( (retired = shard->retired) && retired->epoch + 2 <= epoch ) {
+		if ( !(shard->retired = retired->next) ) shard->retired_tail = NULL;
+		shard->retired_count--;
+		free_retired(ht, shard, retired);
+	}
+}
+
+/* waits until every read section open now is closed (not from inside a read section) */
+static int wait_readers(void)
+{
+	uint64_t epoch = __atomic_load_n(&ht_epoch, __ATOMIC_ACQUIRE) + 2;
+
+	if ( ht_self && ht_self->nest > 0 ) {
+		TSNET_SET_ERROR("wait_readers() is failed: (errmsg: called in a read section)");
+		return -1;
+	}
+
+	while ( epoch_advance() < epoch ) sched_yield();
+
+	return 0;
+}
+
+static void retire(HashTable *ht, struct ht_shard *shard, void *ptr, size_t size, char bucket, char erase)
+{
+	struct ht_retired *retired;
+
+	// no record to defer it: freed after the readers (leaked when the writer itself is reading)
+	if ( !(retired = tsnet_slab_alloc(&shard->slab, sizeof(struct ht_retired))) ) {
+		if ( wait_readers() < 0 ) return;
+
+		if ( bucket && erase && ht->erase_free ) ht->erase_free(((HashTableBucket *)ptr)->value);
+		tsnet_slab_free(&shard->slab, ptr, size);
+		return;
+	}
+
+	retired->next = NULL;
+	retired->epoch = __atomic_load_n(&ht_epoch, __ATOMIC_ACQUIRE);
+	retired->ptr = ptr;
+	retired->size = size;
+	retired->bucket = bucket;
+	retired->erase = erase;
+
+	if ( shard->retired_tail ) shard->retired_tail->next = retired;
+	else shard->retired = retired;
+	shard->retired_tail = retired;
+	shard->retired_count++;
+}
+
+static struct ht_cbuckets * alloc_buckets(struct ht_shard *shard, size_t size)
+{
+	struct ht_cbuckets *buckets;
+	size_t bytes = sizeof(struct ht_cbuckets) + sizeof(HashTableBucket *) * size;
+
+	if ( !(buckets = tsnet_slab_alloc(&shard->slab, bytes)) ) return NULL;
+
+	memset(buckets, 0x00, bytes);
+	buckets->size = size;
+
+	return buckets;
+}
+
+static inline size_t buckets_bytes(struct ht_cbuckets *buckets)
+{
+	return sizeof(struct ht_cbuckets) + sizeof(HashTableBucket *) * buckets->size;
+}
+
+/* an unpublished array and all of its nodes, with the array it was moving (erase_free() is not called) */
+static void retire_buckets(HashTable *ht, struct ht_shard *shard, struct ht_cbuckets *buckets)
+{
+	HashTableBucket *node, *next;
+
+	if ( buckets->old ) retire_buckets(ht, shard, buckets->old);
+
+	for ( size_t i = 0; i < buckets->size; i++ ) {
+		for ( node = buckets->b[i]; node; node = next ) {
+			next = node->next;
+			retire(ht, shard, node, node_size(ht, node->key_len, node->value_len), 1, 0);
+		}
+	}
+
+	retire(ht, shard, buckets, buckets_bytes(buckets), 0, 0);
+}
+
+static HashTableBucket * node_new(HashTable *ht, struct ht_shard *shard, const void *key, size_t key_len, const void *value, size_t value_len)
+{
+	HashTableBucket *node;
+
+	if ( !(node = tsnet_slab_alloc(&shard->slab, node_size(ht, key_len, value_len))) ) return NULL;
+
+	node->key = node->data;
+	node->key_len = key_len;
+	node->value_len = value_len;
+	node->next = NULL;
+
+	memcpy(node->key, key, key_len);
+	node->data[key_len] = 0x00;
+
+	// the caller keeps a borrowed value alive (erase_free() can release it)
+	if ( ht->flags & HT_BORROW_VALUE ) node->value = (void *)value;
+	else {
+		node->value = node->data + key_len + 1;
+		memcpy(node->value, value, value_len);
+		((uint8_t *)node->value)[value_len] = 0x00;
+	}
+
+	return node;
+}
+
+/* the chain a writer uses: one the resize has not moved yet stays in the old array (all nodes of a key are in one chain) */
+static HashTableBucket ** write_chain(struct ht_shard *shard, uint64_t hash)
+{
+	struct ht_cbuckets *old = shard->buckets->old;
+
+	if ( old && (hash & (old->size - 1)) >= shard->migrate ) return chain_of(old, hash);
+
+	return chain_of(shard->buckets, hash);
+}
+
+/* copies of the chain are linked into the new array before the old chain is cut, then the old nodes are retired */
+static int migrate_chain(HashTable *ht, struct ht_shard *shard, HashTableBucket **old_chain)
+{
+	HashTableBucket **chain, *node, *next, *copy, *reversed = NULL;
+
+	for ( node = *old_chain; node; node = node->next ) {
+		size_t bytes = node_size(ht, node->key_len, node->value_len);
+
+		if ( !(copy = tsnet_slab_alloc(&shard->slab, bytes)) ) goto fail;
+
+		memcpy(copy, node, bytes);
+		copy->key = copy->data;
+		if ( !(ht->flags & HT_BORROW_VALUE) ) copy->value = copy->data + node->key_len + 1;
+
+		copy->next = reversed;
+		reversed = copy;
+	}
+
+	// reversed, so pushing each one at the head of its new chain keeps the order
+	for ( copy = reversed; copy; copy = next ) {
+		next = copy->next;
+
+		chain = chain_of(shard->buckets, ht_hash(ht, copy->key, copy->key_len));
+		copy->next = *chain;
+		__atomic_store_n(chain, copy, __ATOMIC_RELEASE);
+	}
+
+	// a reader that loads the cut chain sees the copies in the new array
+	node = *old_chain;
+	__atomic_store_n(old_chain, NULL, __ATOMIC_RELEASE);
+
+	for ( ; node; node = next ) {
+		next = node->next;
+		retire(ht, shard, node, node_size(ht, node->key_len, node->value_len), 1, 0);
+	}
+
+	return 0;
+
+fail:
+	for ( copy = reversed; copy; copy = next ) {
+		next = copy->next;
+		tsnet_slab_free(&shard->slab, copy, node_size(ht, copy->key_len, copy->value_len));
+	}
+
+	return -1;
+}
+
+/* moves HT_MIGRATE_STEP old chains (empty ones are cheap, but a sparse shard must not make one write walk all of them) */
+static void migrate_step(HashTable *ht, struct ht_shard *shard)
+{
+	struct ht_cbuckets *old = shard->buckets->old;
+	size_t moved = 0, visited = 0;
+
+	if ( !old ) return;
+
+	while ( shard->migrate < old->size && moved < HT_MIGRATE_STEP && visited < HT_MIGRATE_STEP * 10 ) {
+		if ( old->b[shard->migrate] ) {
+			// out of memory: the resize goes on with a later write
+			if ( migrate_chain(ht, shard, &old->b[shard->migrate]) < 0 ) return;
+			moved++;
+		}
+
+		shard->migrate++;
+		visited++;
+	}
+
+	if ( shard->migrate == old->size ) {
+		__atomic_store_n(&shard->buckets->old, NULL, __ATOMIC_RELEASE);
+		retire(ht, shard, old, buckets_bytes(old), 0, 0);
+		shard->migrate = 0;
+	}
+}
+
+/* the new array is published at once with the old one behind it, migrate_step() moves the chains */
+static void resize_shard(struct ht_shard *shard, size_t size)
+{
+	struct ht_cbuckets *buckets;
+
+	if ( !(buckets = alloc_buckets(shard, size)) ) return; // the table keeps working, only with longer chains
+
+	buckets->old = shard->buckets;
+	shard->migrate = 0;
+
+	__atomic_store_n(&shard->buckets, buckets, __ATOMIC_RELEASE);
+}
+
+/* same load rule as the chained engine, per shard (one migration at a time) */
+static void check_load(HashTable *ht, struct ht_shard *shard)
+{
+	size_t size = shard->buckets->size;
+
+	if ( shard->buckets->old ) return;
+
+	if ( shard->size > size * ht->max_bucket_link ) resize_shard(shard, size << 1);
+	else if ( size > shard->init_size && shard->size < size * ht->max_bucket_link / 8 ) resize_shard(shard, size >> 1);
+}
+
+/* loads of a read section (or under the shard lock) */
+static HashTableBucket * find_chain(HashTableBucket *node, const void *key, size_t key_len)
+{
+	for ( ; node; node = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE) ) {
+		if ( compare_key(node->key, node->key_len, key, key_len) == 0 ) return node;
+	}
+
+	return NULL;
+}
+
+/* first node of the key in a read section: the old chain of a resize first (a key found there is not in the new array) */
+static HashTableBucket * lookup(struct ht_shard *shard, uint64_t hash, const void *key, size_t key_len)
+{
+	struct ht_cbuckets *buckets = __atomic_load_n(&shard->buckets, __ATOMIC_ACQUIRE), *old, *next;
+	HashTableBucket *node;
+
+	for ( ;; ) {
+		if ( (old = __atomic_load_n(&buckets->old, __ATOMIC_ACQUIRE)) && (node = find_chain(__atomic_load_n(chain_of(old, hash), __ATOMIC_ACQUIRE), key, key_len)) ) return node;
+		if ( (node = find_chain(__atomic_load_n(chain_of(buckets, hash), __ATOMIC_ACQUIRE), key, key_len)) ) return node;
+
+		// a resize published after the array was loaded can have cut the chain
+		if ( (next = __atomic_load_n(&shard->buckets, __ATOMIC_ACQUIRE)) == buckets ) return NULL;
+		buckets = next;
+	}
+}
+
+/* a node given to the caller is only valid in the caller's read section */
+static int check_read_section(void)
+{
+	if ( !ht_self || ht_self->nest == 0 ) {
+		TSNET_SET_ERROR("invalid call: (errmsg: HT_CONCURRENT find() needs the caller's ht_read_lock())");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int ht_concurrent_insert(HashTable *ht, const void *key, size_t key_len, const void *value, size_t value_len)
+{
+	int ret = -1;
+	uint64_t hash;
+	struct ht_shard *shard;
+	HashTableBucket **chain, *node;
+
+	if ( !ht || !key || key_len == 0 || !value || (value_len == 0 && !(ht->flags & HT_BORROW_VALUE)) ) {
+		TSNET_SET_ERROR("invalid argument: (ht = %s, key = %s, key_len = %lu, value = %s, value_len = %lu)", CKNUL(ht), CKNUL(key), key_len, CKNUL(value), value_len);
+		return -1;
+	}
+
+	hash = ht_hash(ht, key, key_len);
+	shard = shard_of(ht, hash);
+
+	pthread_mutex_lock(&shard->lock);
+
+	migrate_step(ht, shard);
+
+	chain = write_chain(shard, hash);
+
+	if ( !ht->multi_key && find_chain(*chain, key, key_len) ) {
+		TSNET_SET_ERROR("compare_key() is failed: (errmsg: duplication key)");
+		goto out;
+	}
+
+	if ( !(node = node_new(ht, shard, key, key_len, value, value_len)) ) goto out;
+
+	// appended like ht_insert() (HT_MULTI_KEY finds the oldest first), the node is complete before readers can reach it
+	while ( *chain ) chain = &(*chain)->next;
+	__atomic_store_n(chain, node, __ATOMIC_RELEASE);
+
+	shard->size++;
+	__atomic_add_fetch(&ht->size, 1, __ATOMIC_RELAXED);
+
+	check_load(ht, shard);
+	ret = 0;
+
+out:
+	reclaim(ht, shard);
+	pthread_mutex_unlock(&shard->lock);
+
+	return ret;
+}
+
+static int ht_concurrent_erase(HashTable *ht, const void *key, size_t key_len, int8_t multi_key_erase)
+{
+	int erased = 0;
+	uint64_t hash;
+	struct ht_shard *shard;
+	HashTableBucket **chain, *node;
+
+	hash = ht_hash(ht, key, key_len);
+	shard = shard_of(ht, hash);
+
+	pthread_mutex_lock(&shard->lock);
+
+	migrate_step(ht, shard);
+
+	chain = write_chain(shard, hash);
+
+	while ( (node = *chain) ) {
+		if ( compare_key(node->key, node->key_len, key, key_len) != 0 ) {
+			chain = &node->next;
+			continue;
+		}
+
+		// node->next is kept, a reader standing on the node goes on
+		__atomic_store_n(chain, node->next, __ATOMIC_RELEASE);
+		retire(ht, shard, node, node_size(ht, node->key_len, node->value_len), 1, 1);
+
+		shard->size--;
+		__atomic_sub_fetch(&ht->size, 1, __ATOMIC_RELAXED);
+
+		erased++;
+		if ( !multi_key_erase ) break;
+	}
+
+	if ( erased ) check_load(ht, shard);
+
+	reclaim(ht, shard);
+	pthread_mutex_unlock(&shard->lock);
+
+	return erased ? 0 /* erased */ : -1; /* cant found */
+}
+
+/* every shard goes back to its initial size */
+static int ht_concurrent_clear(HashTable *ht)
+{
+	struct ht_cbuckets *old, *buckets;
+	int ret = 0;
+
+	if ( !ht || !ht->shards ) return -1;
+
+	for ( size_t s = 0; s < ((size_t)1 << HT_SHARD_BITS); s++ ) {
+		struct ht_shard *shard = &ht->shards[s];
+
+		pthread_mutex_lock(&shard->lock);
+
+		old = shard->buckets;
+		if ( (buckets = alloc_buckets(shard, shard->init_size)) ) {
+			__atomic_store_n(&shard->buckets, buckets, __ATOMIC_RELEASE);
+
+			retire_buckets(ht, shard, old);
+
+			__atomic_sub_fetch(&ht->size, shard->size, __ATOMIC_RELAXED);
+			shard->size = 0;
+			shard->migrate = 0;
+		}
+		else ret = -1;
+
+		reclaim(ht, shard);
+		pthread_mutex_unlock(&shard->lock);
+	}
+
+	return ret;
+}
+
+/* in the caller's read section, the bucket is valid until its ht_read_unlock() */
+static HashTableBucket * ht_concurrent_find(HashTable *ht, const void *key, size_t key_len)
+{
+	uint64_t hash = ht_hash(ht, key, key_len);
+
+	if ( check_read_section() < 0 ) return NULL;
+
+	return lookup(shard_of(ht, hash), hash, key, key_len);
+}
+
+static int ht_concurrent_count(HashTable *ht, const void *key, size_t key_len)
+{
+	int count = 0;
+	uint64_t hash = ht_hash(ht, key, key_len);
+	HashTableBucket *node;
+
+	if ( ht_read_lock() < 0 ) return 0;
+
+	// the nodes of a key are in the chain of the first one
+	for ( node = lookup(shard_of(ht, hash), hash, key, key_len); node; node = find_chain(__atomic_load_n(&node->next, __ATOMIC_ACQUIRE), key, key_len) ) {
+		count++;
+		if ( !ht->multi_key ) break;
+	}
+
+	ht_read_unlock();
+
+	return count;
+}
+
+static int ht_concurrent_empty(HashTable *ht, const void *key, size_t key_len)
+{
+	int empty;
+	uint64_t hash = ht_hash(ht, key, key_len);
+
+	if ( ht_read_lock() < 0 ) return 1;
+	empty = lookup(shard_of(ht, hash), hash, key, key_len) ? 0 /* not empty */ : 1 /* empty */;
+	ht_read_unlock();
+
+	return empty;
+}
+
+/* bucket heads and first nodes are prefetched a pass ahead of the lookups */
+static size_t find_batch_chunk(HashTable *ht, const void * const *keys, const size_t *lens, size_t n, HashTableBucket **out)
+{
+	uint64_t hash[HT_FIND_BATCH];
+	HashTableBucket *head;
+	size_t found = 0;
+
+	PANIC(n <= HT_FIND_BATCH);
+
+	for ( size_t i = 0; i < n; i++ ) {
+		hash[i] = ht_hash(ht, keys[i], lens[i]);
+		__builtin_prefetch(chain_of(__atomic_load_n(&shard_of(ht, hash[i])->buckets, __ATOMIC_ACQUIRE), hash[i]));
+	}
+
+	for ( size_t i = 0; i < n; i++ ) {
+		if ( (head = __atomic_load_n(chain_of(__atomic_load_n(&shard_of(ht, hash[i])->buckets, __ATOMIC_ACQUIRE), hash[i]), __ATOMIC_ACQUIRE)) ) __builtin_prefetch(head);
+	}
+
+	for ( size_t i = 0; i < n; i++ ) {
+		if ( (out[i] = lookup(shard_of(ht, hash[i]), hash[i], keys[i], lens[i])) ) found++;
+	}
+
+	return found;
+}
+
+/* in the caller's read section, like find() */
+size_t ht_concurrent_find_batch(HashTable *ht, const void * const *keys, const size_t *lens, size_t n, HashTableBucket **out)
+{
+	size_t found = 0;
+
+	if ( check_read_section() < 0 ) {
+		memset(out, 0x00, sizeof(HashTableBucket *) * n);
+		return 0;
+	}
+
+	// the stack arrays hold HT_FIND_BATCH keys
+	for ( ; n > HT_FIND_BATCH; n -= HT_FIND_BATCH, keys += HT_FIND_BATCH, lens += HT_FIND_BATCH, out += HT_FIND_BATCH ) found += find_batch_chunk(ht, keys, lens, HT_FIND_BATCH, out);
+
+	return found + find_batch_chunk(ht, keys, lens, n, out);
+}
+
+int ht_concurrent_init(HashTable *ht, size_t init_size, size_t max_bucket_link)
+{
+	size_t shards = (size_t)1 << HT_SHARD_BITS, size = HT_SHARD_START_SIZE;
+
+	if ( posix_memalign((void **)&ht->shards, HT_CACHE_LINE, sizeof(struct ht_shard) * shards) != 0 ) {
+		ht->shards = NULL;
+		TSNET_SET_ERROR("posix_memalign() is failed: (size: %lu)", sizeof(struct ht_shard) * shards);
+		return -1;
+	}
+	memset(ht->shards, 0x00, sizeof(struct ht_shard) * shards);
+
+	for ( ; size < init_size / shards; size = size << 1 ) {/* no action */}
+
+	ht->max_bucket_link = max_bucket_link ? max_bucket_link : 1;
+
+	for ( size_t s = 0; s < shards; s++ ) {
+		struct ht_shard *shard = &ht->shards[s];
+
+		pthread_mutex_init(&shard->lock, NULL);
+		if ( tsnet_slab_init(&shard->slab, 0) < 0 ) return -1;
+
+		shard->init_size = size;
+		if ( !(shard->buckets = alloc_buckets(shard, size)) ) return -1;
+	}
+
+	ht->insert = ht_concurrent_insert;
+	ht->erase = ht_concurrent_erase;
+	ht->clear = ht_concurrent_clear;
+	ht->find = ht_concurrent_find;
+	ht->count = ht_concurrent_count;
+	ht->empty = ht_concurrent_empty;
+
+	return 0;
+}
+
+/* no thread may use the table any more, retired memory is freed at once */
+void ht_concurrent_release(HashTable *ht)
+{
+	struct ht_retired *retired;
+	HashTableBucket *node;
+
+	if ( !ht->shards ) return;
+
+	for ( size_t s = 0; s < ((size_t)1 << HT_SHARD_BITS); s++ ) {
+		struct ht_shard *shard = &ht->shards[s];
+
+		while ( (retired = shard->retired) ) {
+			shard->retired = retired->next;
+			free_retired(ht, shard, retired);
+		}
+
+		// the chains of a resize in progress are in both arrays
+		for ( struct ht_cbuckets *buckets = shard->buckets; buckets; buckets = buckets->old ) {
+			for ( size_t i = 0; i < buckets->size; i++ ) {
+				while ( (node = buckets->b[i]) ) {
+					buckets->b[i] = node->next;
+					tsnet_slab_free(&shard->slab, node, node_size(ht, node->key_len, node->value_len));
+				}
+			}
+		}
+
+		tsnet_slab_clear(&shard->slab);
+		pthread_mutex_destroy(&shard->lock);
+	}
+
+	safe_free(ht->shards);
+}
+
+/* the shards are re-created with it, so only while the table is empty */
+int ht_concurrent_huge_pages(HashTable *ht, char enable)
+{
+	for ( size_t s = 0; s < ((size_t)1 << HT_SHARD_BITS); s++ ) {
+		struct ht_shard *shard = &ht->shards[s];
+
+		if ( shard->size || shard->retired ) {
+			TSNET_SET_ERROR("table is in use: (shard: %lu, size: %lu, retired: %lu)", s, shard->size, shard->retired_count);
+			return -1;
+		}
+	}
+
+	for ( size_t s = 0; s < ((size_t)1 << HT_SHARD_BITS); s++ ) {
+		struct ht_shard *shard = &ht->shards[s];
+		size_t size = shard->buckets->size;
+
+		// an empty shard can still be moving its (empty) old array
+		if ( shard->buckets->old ) tsnet_slab_free(&shard->slab, shard->buckets->old, buckets_bytes(shard->buckets->old));
+		shard->migrate = 0;
+
+		tsnet_slab_free(&shard->slab, shard->buckets, buckets_bytes(shard->buckets));
+		if ( tsnet_slab_init(&shard->slab, enable) < 0 ) return -1;
+		if ( !(shard->buckets = alloc_buckets(shard, size)) ) return -1;
+	}
+
+	return 0;
+}
+
+/* sum of the shard slabs */
+void ht_concurrent_slab_stats(HashTable *ht, struct tsnet_slab_stats *stats)
+{
+	struct tsnet_slab_stats shard;
+
+	memset(stats, 0x00, sizeof(struct tsnet_slab_stats));
+
+	for ( size_t s = 0; s < ((size_t)1 << HT_SHARD_BITS); s++ ) {
+		tsnet_slab_stats(&ht->shards[s].slab, &shard);
+
+		stats->slab_bytes = shard.slab_bytes;
+		stats->slabs += shard.slabs;
+		stats->huge_slabs += shard.huge_slabs;
+		stats->mapped += shard.mapped;
+		stats->used += shard.used;
+		stats->large += shard.large;
+		stats->large_bytes += shard.large_bytes;
+
+		for ( size_t i = 0; i < TSNET_SLAB_CLASSES; i++ ) {
+			stats->classes[i].size = shard.classes[i].size;
+			stats->classes[i].slabs += shard.classes[i].slabs;
+			stats->classes[i].used += shard.classes[i].used;
+			stats->classes[i].capacity += shard.classes[i].capacity;
+		}
+	}
+}
+
+void ht_concurrent_dump(HashTable *ht, char detail)
+{
+	printf("shards:                  %d\n", 1 << HT_SHARD_BITS);
+	printf("size:                    %lu\n", __atomic_load_n(&ht->size, __ATOMIC_RELAXED));
+	printf("epoch:                   %lu\n", __atomic_load_n(&ht_epoch, __ATOMIC_RELAXED));
+
+	if ( detail ) {
+		for ( size_t s = 0; s < ((size_t)1 << HT_SHARD_BITS); s++ ) {
+			struct ht_shard *shard = &ht->shards[s];
+
+			pthread_mutex_lock(&shard->lock);
+			printf("shard[%lu] buckets: %lu, size: %lu, retired: %lu%s\n", s, shard->buckets->size, shard->size, shard->retired_count, shard->buckets->old ? " (resizing)" : "");
+			pthread_mutex_unlock(&shard->lock);
+		}
+	}
+}
@@ -0,0 +1,151 @@
+#include <sys/random.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "hashtable_inter.h"
+#include "halfsiphash.h"
+
+static uint64_t ht_seed;
+static pthread_once_t ht_seed_once = PTHREAD_ONCE_INIT;
+
+static void init_seed(void)
+{
+	struct timespec ts;
+
+	if ( getrandom(&ht_seed, sizeof(ht_seed), GRND_NONBLOCK) == sizeof(ht_seed) ) return;
+
+	// no entropy yet (early boot), still different per process
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	ht_seed = ((uint64_t)ts.tv_sec << 32) ^ ts.tv_nsec ^ ((uint64_t)getpid() << 16) ^ (uintptr_t)&ts;
+}
+
+/* random per process, so colliding keys can't be prepared in advance (hash flooding) */
+uint64_t ht_hash_seed(void)
+{
+	pthread_once(&ht_seed_once, init_seed);
+
+	return ht_seed;
+}
+
+/* multiply-xorshift mix (all bits of x reach the low bits used as bucket index) */
+static inline uint64_t mix64(uint64_t x)
+{
+	x ^= x >> 32;
+	x *= 0xd6e8feb86659fd93ULL;
+	x ^= x >> 32;
+	x *= 0xd6e8feb86659fd93ULL;
+	x ^= x >> 32;
+
+	return x;
+}
+
+/* wyhash: 64x64 -> 128 bit multiplies over 8 byte reads */
+static const uint64_t wyp[4] = { 0xa0761d6478bd642fULL, 0xe7037ed1a0b428dbULL, 0x8ebc6af09c88c6e3ULL, 0x589965cc75374cc3ULL };
+
+static inline uint64_t wymix(uint64_t a, uint64_t b)
+{
+	__uint128_t r = (__uint128_t)a * b;
+
+	return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+
+static inline uint64_t wyr8(const uint8_t *p)
+{
+	uint64_t v;
+
+	memcpy(&v, p, sizeof(v));
+
+	return v;
+}
+
+static inline uint64_t wyr4(const uint8_t *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+
+	return v;
+}
+
+/* 1 ~ 3 bytes */
+static inline uint64_t wyr3(const uint8_t *p, size_t k)
+{
+	return ((uint64_t)p[0] << 16) | ((uint64_t)p[k >> 1] << 8) | p[k - 1];
+}
+
+uint64_t ht_hash_wyhash(const void *key, size_t key_len, uint64_t seed)
+{
+	const uint8_t *p = key;
+	uint64_t a, b;
+	size_t i = key_len;
+
+	seed ^= wymix(seed ^ wyp[0], wyp[1]);
+
+	if ( key_len <= 16 ) {
+		if ( key_len >= 4 ) {
+			a = (wyr4(p) << 32) | wyr4(p + ((key_len >> 3) << 2));
+			b = (wyr4(p + key_len - 4) << 32) | wyr4(p + key_len - 4 - ((key_len >> 3) << 2));
+		}
+		else if ( key_len > 0 ) {
+			a = wyr3(p, key_len);
+			b = 0;
+		}
+		else a = b = 0;
+	}
+	else {
+		if ( i > 48 ) {
+			uint64_t see1 = seed, see2 = seed;
+
+			do {
+				seed = wymix(wyr8(p) ^ wyp[1], wyr8(p + 8) ^ seed);
+				see1 = wymix(wyr8(p + 16) ^ wyp[2], wyr8(p + 24) ^ see1);
+				see2 = wymix(wyr8(p + 32) ^ wyp[3], wyr8(p + 40) ^ see2);
+				p += 48;
+				i -= 48;
+			} while ( i > 48 );
+
+			seed ^= see1 ^ see2;
+		}
+
+		for ( ; i > 16; i -= 16, p += 16 ) seed = wymix(wyr8(p) ^ wyp[1], wyr8(p + 8) ^ seed);
+
+		a = wyr8(p + i - 16);
+		b = wyr8(p + i - 8);
+	}
+
+	a ^= wyp[1];
+	b ^= seed;
+
+	__uint128_t r = (__uint128_t)a * b;
+	a = (uint64_t)r;
+	b = (uint64_t)(r >> 64);
+
+	return wymix(a ^ wyp[0] ^ key_len, b ^ wyp[1]);
+}
+
+uint64_t ht_hash_halfsiphash(const void *key, size_t key_len, uint64_t seed)
+{
+	uint64_t hash;
+
+	halfsiphash(key, key_len, (const uint8_t *)&seed, (uint8_t *)&hash, sizeof(hash));
+
+	return hash;
+}
+
+/* 4 and 8 byte keys (fd, id, pointer) are mixed as integers, others go through wyhash */
+uint64_t ht_hash_default(const void *key, size_t key_len, uint64_t seed)
+{
+	uint32_t k32;
+	uint64_t k64;
+
+	switch ( key_len ) {
+		case sizeof(k32):
+			memcpy(&k32, key, sizeof(k32));
+			return mix64(k32 ^ seed);
+		case sizeof(k64):
+			memcpy(&k64, key, sizeof(k64));
+			return mix64(k64 ^ seed);
+		default:
+			return ht_hash_wyhash(key, key_len, seed);
+	}
+}
@@ -0,0 +1,35 @@
+#include <stddef.h>
+
+#include "tsnet_common_inter.h"
+#include "hashtable.h"
+
+#define HT_FIND_BATCH 16 /* keys of ht_find_batch() resolved together (hashes and prefetched lines kept on the stack) */
+
+static inline uint64_t ht_hash(HashTable *ht, const void *key, size_t key_len)
+{
+	return ht->hash(key, key_len, ht->seed);
+}
+
+static inline int compare_key(const void *key, size_t key_len, const void *cmp_key, size_t cmp_key_len)
+{
+	if ( key_len == cmp_key_len ) return memcmp(key, cmp_key, key_len);
+
+	return 1; // not same
+}
+
+int ht_entry_copy(HashTable *ht, HashTableBucket *entry, size_t room, const void *key, size_t key_len, const void *value, size_t value_len);
+void ht_entry_free(HashTable *ht, HashTableBucket *entry, char erase);
+
+/* HT_OPEN_ADDRESSING (hashtable_swiss.c) */
+int ht_swiss_init(HashTable *ht, size_t init_size);
+void ht_swiss_release(HashTable *ht);
+void ht_swiss_dump(HashTable *ht, char detail);
+/* HT_CONCURRENT (hashtable_concurrent.c) */
+int ht_concurrent_init(HashTable *ht, size_t init_size, size_t max_bucket_link);
+void ht_concurrent_release(HashTable *ht);
+void ht_concurrent_dump(HashTable *ht, char detail);
+int ht_concurrent_huge_pages(HashTable *ht, char enable);
+void ht_concurrent_slab_stats(HashTable *ht, struct tsnet_slab_stats *stats);
+size_t ht_concurrent_find_batch(HashTable *ht, const void * const *keys, const size_t *lens, size_t n, HashTableBucket **out); /* any n, HT_FIND_BATCH at a time */
+
+size_t ht_swiss_find_batch(HashTable *ht, const void * const *keys, const size_t *lens, size_t n, HashTableBucket **out); /* any n, HT_FIND_BATCH at a time */
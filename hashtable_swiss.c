@@ -0,0 +1,524 @@
+#include "hashtable_inter.h"
+#include "tsnet_slab.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define HT_GROUP_WIDTH 32 /* control bytes compared by one probe */
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define HT_GROUP_WIDTH 16
+#else
+#define HT_GROUP_WIDTH 16
+#endif
+
+#define HT_SWISS_START_SIZE 32 /* slots, power of two and at least HT_GROUP_WIDTH */
+#define HT_REHASH_STEP 16 /* old slots migrated by each insert / erase while the table is resized */
+
+#define HT_CTRL_EMPTY ((int8_t)-128)
+#define HT_CTRL_DELETED ((int8_t)-2) /* full slots are 0 ~ 127, so empty and deleted are the negative ones */
+
+#define HT_H1(hash) ((hash) >> 7) /* probe start */
+#define HT_H2(hash) ((int8_t)((hash) & 0x7f)) /* kept in the control byte */
+
+/* bit n: ctrl[n] == h2 */
+static inline uint32_t group_match(const int8_t *ctrl, int8_t h2)
+{
+#if defined(__AVX2__)
+	__m256i group = _mm256_loadu_si256((const __m256i *)ctrl);
+
+	return (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(group, _mm256_set1_epi8(h2)));
+#elif defined(__SSE2__)
+	__m128i group = _mm_loadu_si128((const __m128i *)ctrl);
+
+	return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(h2)));
+#else
+	uint32_t mask = 0;
+
+	for ( int i = 0; i < HT_GROUP_WIDTH; i++ ) {
+		if ( ctrl[i] == h2 ) mask |= 1U << i;
+	}
+
+	return mask;
+#endif
+}
+
+static inline uint32_t group_match_empty(const int8_t *ctrl)
+{
+	return group_match(ctrl, HT_CTRL_EMPTY);
+}
+
+/* empty or deleted (sign bit of the control byte) */
+static inline uint32_t group_match_free(const int8_t *ctrl)
+{
+#if defined(__AVX2__)
+	return (uint32_t)_mm256_movemask_epi8(_mm256_loadu_si256((const __m256i *)ctrl));
+#elif defined(__SSE2__)
+	return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)ctrl));
+#else
+	uint32_t mask = 0;
+
+	for ( int i = 0; i < HT_GROUP_WIDTH; i++ ) {
+		if ( ctrl[i] < 0 ) mask |= 1U << i;
+	}
+
+	return mask;
+#endif
+}
+
+static inline size_t max_load(size_t capacity)
+{
+	return capacity - capacity / 8; // 7/8, so a probe always meets an empty slot
+}
+
+static void set_ctrl(int8_t *ctrl, size_t capacity, size_t i, int8_t h)
+{
+	ctrl[i] = h;
+	if ( i < HT_GROUP_WIDTH ) ctrl[capacity + i] = h; // a group loaded near the end reads the mirror
+}
+
+/* probe sequence: groups at H1, H1 + W, H1 + 3W, ... (triangular, it visits every group of a 2^n table) */
+struct ht_probe {
+	const int8_t *ctrl;
+	HashTableBucket *slots;
+	size_t mask, pos, step;
+	int8_t h2;
+	uint32_t match; // slots of the group with the same h2, not checked yet
+	char last; // the group has an empty slot, the key can't be further
+};
+
+static void probe_group(struct ht_probe *probe)
+{
+	probe->match = group_match(probe->ctrl + probe->pos, probe->h2);
+	probe->last = group_match_empty(probe->ctrl + probe->pos) != 0;
+}
+
+static void probe_start(struct ht_probe *probe, const int8_t *ctrl, HashTableBucket *slots, size_t capacity, uint64_t hash)
+{
+	probe->ctrl = ctrl;
+	probe->slots = slots;
+	probe->mask = capacity - 1;
+	probe->pos = HT_H1(hash) & probe->mask;
+	probe->step = 0;
+	probe->h2 = HT_H2(hash);
+	probe_group(probe);
+}
+
+/* next slot holding key (-1: none) */
+static ssize_t probe_next(struct ht_probe *probe, const void *key, size_t key_len)
+{
+	size_t i;
+
+	while (1) {
+		while ( probe->match ) {
+			i = (probe->pos + __builtin_ctz(probe->match)) & probe->mask;
+			probe->match &= probe->match - 1;
+
+			if ( compare_key(probe->slots[i].key, probe->slots[i].key_len, key, key_len) == 0 ) return i;
+		}
+
+		if ( probe->last ) return -1;
+
+		probe->step += HT_GROUP_WIDTH;
+		probe->pos = (probe->pos + probe->step) & probe->mask;
+		probe_group(probe);
+	}
+}
+
+/* first empty or deleted slot of the probe sequence */
+static size_t find_free_slot(const int8_t *ctrl, size_t capacity, uint64_t hash)
+{
+	size_t mask = capacity - 1, pos = HT_H1(hash) & mask, step = 0;
+	uint32_t match;
+
+	while ( !(match = group_match_free(ctrl + pos)) ) {
+		step += HT_GROUP_WIDTH;
+		pos = (pos + step) & mask;
+	}
+
+	return (pos + __builtin_ctz(match)) & mask;
+}
+
+static int alloc_table(HashTable *ht, size_t capacity, int8_t **ctrl, HashTableBucket **slots)
+{
+	if ( !(*ctrl = tsnet_slab_alloc(ht->slab, capacity + HT_GROUP_WIDTH)) ) return -1;
+
+	if ( !(*slots = tsnet_slab_alloc(ht->slab, capacity * sizeof(HashTableBucket))) ) {
+		tsnet_slab_free(ht->slab, *ctrl, capacity + HT_GROUP_WIDTH);
+		return -1;
+	}
+
+	memset(*ctrl, HT_CTRL_EMPTY, capacity + HT_GROUP_WIDTH);
+
+	return 0;
+}
+
+static void free_table(HashTable *ht, int8_t *ctrl, HashTableBucket *slots, size_t capacity)
+{
+	tsnet_slab_free(ht->slab, ctrl, capacity + HT_GROUP_WIDTH);
+	tsnet_slab_free(ht->slab, slots, capacity * sizeof(HashTableBucket));
+}
+
+/* inline copies are relocated with the slot */
+static inline void move_slot(HashTable *ht, HashTableBucket *dst, HashTableBucket *src)
+{
+	*dst = *src;
+
+	if ( src->key != src->data ) return;
+
+	dst->key = dst->data;
+	if ( !(ht->flags & HT_BORROW_VALUE) ) dst->value = dst->data + src->key_len + 1;
+}
+
+/* migrate up to HT_REHASH_STEP old slots (entries are moved, keys and values are not copied) */
+static void rehash_step(HashTable *ht)
+{
+	size_t end, j;
+	uint64_t hash;
+
+	if ( !ht->old_ctrl ) return;
+
+	end = ht->rehash_index + HT_REHASH_STEP;
+	if ( end > ht->old_capacity ) end = ht->old_capacity;
+
+	for ( ; ht->rehash_index < end; ht->rehash_index++ ) {
+		size_t i = ht->rehash_index;
+
+		if ( ht->old_ctrl[i] < 0 ) continue;
+
+		// room was counted in growth_left when the migration started
+		hash = ht_hash(ht, ht->old_slots[i].key, ht->old_slots[i].key_len);
+		j = find_free_slot(ht->ctrl, ht->capacity, hash);
+		set_ctrl(ht->ctrl, ht->capacity, j, HT_H2(hash));
+		move_slot(ht, &ht->slots[j], &ht->old_slots[i]);
+
+		// probes of the old table go on over it
+		set_ctrl(ht->old_ctrl, ht->old_capacity, i, HT_CTRL_DELETED);
+	}
+
+	if ( ht->rehash_index == ht->old_capacity ) {
+		free_table(ht, ht->old_ctrl, ht->old_slots, ht->old_capacity);
+		ht->old_ctrl = NULL;
+		ht->old_slots = NULL;
+		ht->old_capacity = 0;
+		ht->rehash_index = 0;
+	}
+}
+
+/* start moving the entries to a table of capacity slots (same capacity: drop deleted slots), rehash_step() moves them */
+static int resize_table(HashTable *ht, size_t capacity)
+{
+	int8_t *ctrl;
+	HashTableBucket *slots;
+
+	// one migration at a time
+	while ( ht->old_ctrl ) rehash_step(ht);
+
+	if ( alloc_table(ht, capacity, &ctrl, &slots) < 0 ) return -1;
+
+	ht->old_ctrl = ht->ctrl;
+	ht->old_slots = ht->slots;
+	ht->old_capacity = ht->capacity;
+	ht->rehash_index = 0;
+
+	ht->ctrl = ctrl;
+	ht->slots = slots;
+	ht->capacity = capacity;
+	ht->growth_left = max_load(capacity) - ht->size;
+
+	return 0;
+}
+
+static HashTableBucket * find_hashed(HashTable *ht, uint64_t hash, const void *key, size_t key_len);
+
+static int ht_swiss_insert(HashTable *ht, const void *key, size_t key_len, const void *value, size_t value_len)
+{
+	uint64_t hash;
+	size_t i;
+
+	if ( !ht || !key || key_len == 0 || !value || (value_len == 0 && !(ht->flags & HT_BORROW_VALUE)) ) {
+		TSNET_SET_ERROR("invalid argument: (ht = %s, key = %s, key_len = %lu, value = %s, value_len = %lu)", CKNUL(ht), CKNUL(key), key_len, CKNUL(value), value_len);
+		return -1;
+	}
+
+	rehash_step(ht);
+
+	hash = ht_hash(ht, key, key_len);
+
+	if ( !ht->multi_key && find_hashed(ht, hash, key, key_len) ) {
+		TSNET_SET_ERROR("compare_key() is failed: (errmsg: duplication key)");
+		return -1;
+	}
+
+	i = find_free_slot(ht->ctrl, ht->capacity, hash);
+
+	// a deleted slot is reused for free, an empty one needs room (mostly deleted slots: same size without them)
+	if ( ht->ctrl[i] == HT_CTRL_EMPTY && ht->growth_left == 0 ) {
+		if ( resize_table(ht, ht->size <= max_load(ht->capacity) / 2 ? ht->capacity : ht->capacity << 1) < 0 ) return -1;
+		i = find_free_slot(ht->ctrl, ht->capacity, hash);
+	}
+
+	// copied in place, inline copies point into the slot itself
+	if ( ht_entry_copy(ht, &ht->slots[i], (ht->flags & HT_INLINE) ? HT_INLINE_SIZE : 0, key, key_len, value, value_len) < 0 ) return -1;
+
+	if ( ht->ctrl[i] == HT_CTRL_EMPTY ) ht->growth_left--;
+	set_ctrl(ht->ctrl, ht->capacity, i, HT_H2(hash));
+	ht->size++;
+
+	return 0;
+}
+
+static void erase_slot(HashTable *ht, size_t i)
+{
+	size_t mask = ht->capacity - 1;
+	uint32_t empty_before = group_match_empty(ht->ctrl + ((i - HT_GROUP_WIDTH) & mask));
+	uint32_t empty_after = group_match_empty(ht->ctrl + i);
+
+	// no probe has seen a full group over slot i, so it can be empty again (else lookups must probe past it)
+	if ( empty_before && empty_after && (size_t)(__builtin_ctz(empty_after) + __builtin_clz(empty_before) - (32 - HT_GROUP_WIDTH)) < HT_GROUP_WIDTH ) {
+		set_ctrl(ht->ctrl, ht->capacity, i, HT_CTRL_EMPTY);
+		ht->growth_left++;
+	}
+	else set_ctrl(ht->ctrl, ht->capacity, i, HT_CTRL_DELETED);
+}
+
+static int ht_swiss_erase(HashTable *ht, const void *key, size_t key_len, int8_t multi_key_erase)
+{
+	int8_t erased = 0;
+	struct ht_probe probe;
+	uint64_t hash = ht_hash(ht, key, key_len);
+	ssize_t i;
+
+	rehash_step(ht);
+
+	// the old table first, like find(): the entry not migrated yet is the older one
+	// it is dropped after the migration, its slots are only marked
+	if ( ht->old_ctrl ) {
+		probe_start(&probe, ht->old_ctrl, ht->old_slots, ht->old_capacity, hash);
+
+		while ( (i = probe_next(&probe, key, key_len)) >= 0 ) {
+			ht_entry_free(ht, &ht->old_slots[i], 1);
+			set_ctrl(ht->old_ctrl, ht->old_capacity, i, HT_CTRL_DELETED);
+			ht->size--;
+
+			erased = 1;
+			if ( !multi_key_erase ) break;
+		}
+	}
+
+	if ( !erased || multi_key_erase ) {
+		probe_start(&probe, ht->ctrl, ht->slots, ht->capacity, hash);
+
+		while ( (i = probe_next(&probe, key, key_len)) >= 0 ) {
+			ht_entry_free(ht, &ht->slots[i], 1);
+			erase_slot(ht, i);
+			ht->size--;
+
+			erased = 1;
+			if ( !multi_key_erase ) break;
+		}
+	}
+
+	if ( erased && ht->capacity > ht->init_capacity && ht->size < ht->capacity / 16 ) (void)resize_table(ht, ht->capacity >> 1);
+
+	return erased ? 0 /* erased */ : -1; /* cant found */
+}
+
+static void clear_table(HashTable *ht, int8_t *ctrl, HashTableBucket *slots, size_t capacity)
+{
+	for ( size_t i = 0; i < capacity; i++ ) {
+		if ( ctrl[i] >= 0 ) ht_entry_free(ht, &slots[i], 0);
+	}
+}
+
+/* the table goes back to its initial size */
+static int ht_swiss_clear(HashTable *ht)
+{
+	int8_t *ctrl;
+	HashTableBucket *slots;
+
+	if ( !ht || !ht->ctrl ) return -1;
+
+	clear_table(ht, ht->ctrl, ht->slots, ht->capacity);
+
+	if ( ht->old_ctrl ) {
+		clear_table(ht, ht->old_ctrl, ht->old_slots, ht->old_capacity);
+		free_table(ht, ht->old_ctrl, ht->old_slots, ht->old_capacity);
+		ht->old_ctrl = NULL;
+		ht->old_slots = NULL;
+		ht->old_capacity = 0;
+		ht->rehash_index = 0;
+	}
+
+	if ( ht->capacity > ht->init_capacity && alloc_table(ht, ht->init_capacity, &ctrl, &slots) == 0 ) {
+		free_table(ht, ht->ctrl, ht->slots, ht->capacity);
+		ht->ctrl = ctrl;
+		ht->slots = slots;
+		ht->capacity = ht->init_capacity;
+	}
+	else memset(ht->ctrl, HT_CTRL_EMPTY, ht->capacity + HT_GROUP_WIDTH);
+
+	ht->size = 0;
+	ht->growth_left = max_load(ht->capacity);
+
+	return 0;
+}
+
+/* lookups do not migrate, so a found slot stays valid until the next insert or erase
+ * the old table first while migrating: an HT_MULTI_KEY duplicate there was inserted before the ones in the new table */
+static HashTableBucket * find_hashed(HashTable *ht, uint64_t hash, const void *key, size_t key_len)
+{
+	struct ht_probe probe;
+	ssize_t i;
+
+	if ( ht->old_ctrl ) {
+		probe_start(&probe, ht->old_ctrl, ht->old_slots, ht->old_capacity, hash);
+		if ( (i = probe_next(&probe, key, key_len)) >= 0 ) return &ht->old_slots[i];
+	}
+
+	probe_start(&probe, ht->ctrl, ht->slots, ht->capacity, hash);
+	if ( (i = probe_next(&probe, key, key_len)) >= 0 ) return &ht->slots[i];
+
+	return NULL;
+}
+
+static HashTableBucket * ht_swiss_find(HashTable *ht, const void *key, size_t key_len)
+{
+	return find_hashed(ht, ht_hash(ht, key, key_len), key, key_len);
+}
+
+/* control groups, then the slots they match (and their keys) are prefetched a pass ahead of the lookups */
+static size_t find_batch_chunk(HashTable *ht, const void * const *keys, const size_t *lens, size_t n, HashTableBucket **out)
+{
+	uint64_t hash[HT_FIND_BATCH];
+	HashTableBucket *slot[HT_FIND_BATCH];
+	size_t mask = ht->capacity - 1, found = 0;
+
+	PANIC(n <= HT_FIND_BATCH);
+
+	for ( size_t i = 0; i < n; i++ ) {
+		hash[i] = ht_hash(ht, keys[i], lens[i]);
+		__builtin_prefetch(ht->ctrl + (HT_H1(hash[i]) & mask));
+	}
+
+	// the first candidate only, others are rare (7 bits of the hash matched)
+	for ( size_t i = 0; i < n; i++ ) {
+		size_t pos = HT_H1(hash[i]) & mask;
+		uint32_t match = group_match(ht->ctrl + pos, HT_H2(hash[i]));
+
+		slot[i] = match ? &ht->slots[(pos + __builtin_ctz(match)) & mask] : NULL;
+		if ( slot[i] ) __builtin_prefetch(slot[i]);
+	}
+
+	// HT_INLINE keys up to HT_INLINE_SIZE are in the slot already
+	if ( !(ht->flags & HT_INLINE) ) {
+		for ( size_t i = 0; i < n; i++ ) {
+			if ( slot[i] ) __builtin_prefetch(slot[i]->key);
+		}
+	}
+
+	for ( size_t i = 0; i < n; i++ ) {
+		if ( (out[i] = find_hashed(ht, hash[i], keys[i], lens[i])) ) found++;
+	}
+
+	return found;
+}
+
+size_t ht_swiss_find_batch(HashTable *ht, const void * const *keys, const size_t *lens, size_t n, HashTableBucket **out)
+{
+	size_t found = 0;
+
+	// the stack arrays hold HT_FIND_BATCH keys
+	for ( ; n > HT_FIND_BATCH; n -= HT_FIND_BATCH, keys += HT_FIND_BATCH, lens += HT_FIND_BATCH, out += HT_FIND_BATCH ) found += find_batch_chunk(ht, keys, lens, HT_FIND_BATCH, out);
+
+	return found + find_batch_chunk(ht, keys, lens, n, out);
+}
+
+static int ht_swiss_count(HashTable *ht, const void *key, size_t key_len)
+{
+	int count = 0;
+	struct ht_probe probe;
+	uint64_t hash = ht_hash(ht, key, key_len);
+
+	if ( !ht->multi_key ) return ht_swiss_find(ht, key, key_len) ? 1 : 0;
+
+	probe_start(&probe, ht->ctrl, ht->slots, ht->capacity, hash);
+	while ( probe_next(&probe, key, key_len) >= 0 ) count++;
+
+	if ( ht->old_ctrl ) {
+		probe_start(&probe, ht->old_ctrl, ht->old_slots, ht->old_capacity, hash);
+		while ( probe_next(&probe, key, key_len) >= 0 ) count++;
+	}
+
+	return count;
+}
+
+static int ht_swiss_empty(HashTable *ht, const void *key, size_t key_len)
+{
+	return ht_swiss_find(ht, key, key_len) ? 0 /* not empty */ : 1 /* empty */;
+}
+
+int ht_swiss_init(HashTable *ht, size_t init_size)
+{
+	size_t capacity = HT_SWISS_START_SIZE;
+
+	for ( ; capacity < init_size; capacity = capacity << 1 ) {/* no action */}
+
+	if ( alloc_table(ht, capacity, &ht->ctrl, &ht->slots) < 0 ) return -1;
+
+	ht->init_capacity = ht->capacity = capacity;
+	ht->size = 0;
+	ht->growth_left = max_load(ht->capacity);
+
+	ht->insert = ht_swiss_insert;
+	ht->erase = ht_swiss_erase;
+	ht->clear = ht_swiss_clear;
+	ht->find = ht_swiss_find;
+	ht->count = ht_swiss_count;
+	ht->empty = ht_swiss_empty;
+
+	return 0;
+}
+
+void ht_swiss_release(HashTable *ht)
+{
+	if ( ht->ctrl ) {
+		ht_swiss_clear(ht);
+		free_table(ht, ht->ctrl, ht->slots, ht->capacity);
+		ht->ctrl = NULL;
+		ht->slots = NULL;
+	}
+}
+
+void ht_swiss_dump(HashTable *ht, char detail)
+{
+	size_t deleted = 0;
+
+	for ( size_t i = 0; i < ht->capacity; i++ ) {
+		if ( ht->ctrl[i] == HT_CTRL_DELETED ) deleted++;
+	}
+
+	printf("capacity:                %lu\n", ht->capacity);
+	printf("old_capacity:            %lu (migrated: %lu)\n", ht->old_capacity, ht->rehash_index);
+	printf("size:                    %lu\n", ht->size);
+	printf("deleted:                 %lu\n", deleted);
+	printf("growth_left:             %lu\n", ht->growth_left);
+	printf("group_width:             %d\n", HT_GROUP_WIDTH);
+
+	if ( detail ) {
+		// probe length of every entry (groups loaded before its slot)
+		for ( size_t i = 0; i < ht->capacity; i++ ) {
+			size_t pos, step = 0, probes = 1;
+			uint64_t hash;
+
+			if ( ht->ctrl[i] < 0 ) continue;
+
+			hash = ht_hash(ht, ht->slots[i].key, ht->slots[i].key_len);
+			for ( pos = HT_H1(hash) & (ht->capacity - 1); ((i - pos) & (ht->capacity - 1)) >= HT_GROUP_WIDTH; probes++ ) {
+				step += HT_GROUP_WIDTH;
+				pos = (pos + step) & (ht->capacity - 1);
+			}
+
+			printf("slot[%lu] probe count: %lu\n", i, probes);
+		}
+	}
+}
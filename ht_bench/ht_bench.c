@@ -0,0 +1,167 @@
+#include <time.h>
+#include <unistd.h>
+
+#include "tsnet.h"
+
+#define KEY_COUNT 100000 /* keys loaded before the threads start, finds hit them */
+#define MAX_THREADS 64
+
+/* one table under a global mutex (what a shared table needed before HT_CONCURRENT), or HT_CONCURRENT */
+struct bench {
+	HashTable *ht;
+	pthread_mutex_t lock;
+	char concurrent;
+	int read_percent;
+	volatile int stop;
+};
+
+struct worker {
+	pthread_t tid;
+	struct bench *bench;
+	int index;
+	uint64_t ops;
+} __attribute__((aligned(64)));
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* xorshift, each worker has its own */
+static inline uint32_t next_rand(uint64_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+
+	return (uint32_t)*state;
+}
+
+static void * worker_main(void *arg)
+{
+	struct worker *worker = arg;
+	struct bench *bench = worker->bench;
+	HashTable *ht = bench->ht;
+	uint64_t state = 0x9e3779b97f4a7c15ULL * (worker->index + 1);
+	char key[32], value[32];
+	int key_len, value_len;
+
+	while ( !bench->stop ) {
+		uint32_t r = next_rand(&state);
+		HashTableBucket *bucket;
+
+		if ( (int)(r % 100) < bench->read_percent ) {
+			key_len = sprintf(key, "key%u", (r >> 8) % KEY_COUNT);
+
+			if ( bench->concurrent ) {
+				ht_read_lock();
+				if ( (bucket = ht->find(ht, key, key_len)) ) value[0] = ((char *)bucket->value)[0];
+				ht_read_unlock();
+			}
+			else {
+				pthread_mutex_lock(&bench->lock);
+				if ( (bucket = ht->find(ht, key, key_len)) ) value[0] = ((char *)bucket->value)[0];
+				pthread_mutex_unlock(&bench->lock);
+			}
+		}
+		else {
+			// writers churn keys of their own (insert, then erase it next time)
+			key_len = sprintf(key, "w%d-%u", worker->index, (r >> 8) % 1024);
+			value_len = sprintf(value, "%u", r);
+
+			if ( !bench->concurrent ) pthread_mutex_lock(&bench->lock);
+			if ( ht->insert(ht, key, key_len, value, value_len) < 0 ) ht->erase(ht, key, key_len, 0);
+			if ( !bench->concurrent ) pthread_mutex_unlock(&bench->lock);
+		}
+
+		worker->ops++;
+	}
+
+	return NULL;
+}
+
+static int run(char concurrent, int nthreads, int read_percent, double seconds)
+{
+	struct bench bench;
+	struct worker workers[MAX_THREADS];
+	char key[32], value[32];
+	uint64_t ops = 0;
+	double start;
+	int ret = -1;
+
+	memset(&bench, 0x00, sizeof(bench));
+	memset(workers, 0x00, sizeof(workers));
+	pthread_mutex_init(&bench.lock, NULL);
+	bench.concurrent = concurrent;
+	bench.read_percent = read_percent;
+
+	if ( !(bench.ht = ht_create(KEY_COUNT, 0, concurrent ? HT_CONCURRENT : 0, NULL)) ) {
+		fprintf(stderr, "%s\n", tsnet_get_last_error());
+		goto out;
+	}
+
+	for ( int i = 0; i < KEY_COUNT; i++ ) {
+		int key_len = sprintf(key, "key%d", i), value_len = sprintf(value, "value%d", i);
+
+		if ( bench.ht->insert(bench.ht, key, key_len, value, value_len) < 0 ) {
+			fprintf(stderr, "%s\n", tsnet_get_last_error());
+			goto out;
+		}
+	}
+
+	start = now();
+	for ( int i = 0; i < nthreads; i++ ) {
+		workers[i].bench = &bench;
+		workers[i].index = i;
+		if ( pthread_create(&workers[i].tid, NULL, worker_main, &workers[i]) != 0 ) {
+			fprintf(stderr, "pthread_create() is failed\n");
+			bench.stop = 1;
+			nthreads = i;
+			break;
+		}
+	}
+
+	while ( now() - start < seconds && !bench.stop ) usleep(10000);
+	bench.stop = 1;
+
+	for ( int i = 0; i < nthreads; i++ ) {
+		pthread_join(workers[i].tid, NULL);
+		ops += workers[i].ops;
+	}
+
+	printf("%-10s threads %2d  %6.2f Mops/s\n", concurrent ? "concurrent" : "mutex", nthreads, ops / (now() - start) / 1e6);
+	ret = 0;
+
+out:
+	if ( bench.ht ) ht_delete(bench.ht);
+	pthread_mutex_destroy(&bench.lock);
+
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	int read_percent = 90;
+	double seconds = 1;
+
+	if ( argc > 3 ) {
+		fprintf(stderr, "%s [read percent (default: 90)] [seconds per run (default: 1)]\n", argv[0]);
+		return 1;
+	}
+
+	if ( argc >= 2 ) read_percent = atoi(argv[1]);
+	if ( argc >= 3 ) seconds = atof(argv[2]);
+
+	printf("keys %d, reads %d%%, %.1f seconds per run\n", KEY_COUNT, read_percent, seconds);
+
+	for ( int nthreads = 1; nthreads <= MAX_THREADS; nthreads <<= 1 ) {
+		if ( run(0, nthreads, read_percent, seconds) < 0 ) return 1;
+		if ( run(1, nthreads, read_percent, seconds) < 0 ) return 1;
+	}
+
+	return 0;
+}
@@ -38,16 +38,16 @@ static void add_http_response_header(const char *name, const char *value, struct
 	else response->buf_len += snprintf(response->buf + response->buf_len, sizeof(response->buf) - response->buf_len, "%s: %s\r\n", name, value);
 }
 
-const char * make_etag(const char *path)
+/* sha256 of the whole file: CPU heavy, runs on a worker (etag: ETAG_SIZE) */
+void make_etag(const char *path, char *etag)
 {
 	size_t nread;
 	uint8_t hash[32];
 	uint8_t buf[BUFSIZ];
-	static char etag[64] = {0};
 	FILE *fp = NULL;
 	SHA256_CTX ctx;
 
-	memset(etag, 0x00, sizeof(etag));
+	memset(etag, 0x00, ETAG_SIZE);
 
 	sha256_init(&ctx);
 	
@@ -60,15 +60,13 @@ const char * make_etag(const char *path)
 		sha256_update(&ctx, buf, nread);
 	}
 	sha256_final(&ctx, hash);
-	bin2str(hash, sizeof(hash), etag, sizeof(etag));
+	bin2str(hash, sizeof(hash), etag, ETAG_SIZE - 1);
 
 out:
 	if ( fp ) fclose(fp);
-
-	return etag;
 }
 
-static int send_http_response(TSNET *tsnet, socket_t client_fd, int code, const char *msg, const char *path, const char *type)
+static int send_http_response(TSNET *tsnet, socket_t client_fd, int code, const char *msg, const char *path, const char *type, const char *etag)
 {
 	time_t t = time(NULL);
 	char date[64];
@@ -89,7 +87,7 @@ static int send_http_response(TSNET *tsnet, socket_t client_fd, int code, const
 	strftime(date, sizeof(date), "%c", localtime(&st.st_mtime));
 	add_http_response_header("Last-Modified", date, &response, 0);
 	add_http_response_header("Accept-Ranges", "bytes", &response, 0);
-	add_http_response_header("ETag", make_etag(path), &response, 0);
+	add_http_response_header("ETag", etag, &response, 0);
 	strftime(date, sizeof(date), "%c", localtime(&t));
 	add_http_response_header("Date", date, &response, 1);
 	
@@ -112,6 +110,49 @@ out:
 	return -1;
 }
 
+/* loop thread: finished jobs at the head leave in request order */
+static void flush_jobs(TSNET *tsnet, struct http_conn *conn)
+{
+	struct http_job *job;
+
+	conn->flushing = 1; // a failed send can close the connection in here
+	while ( (job = conn->head) && job->done ) {
+		if ( !(conn->head = job->next) ) conn->tail = NULL;
+
+		//TODO: image/gif, image/jpeg, image/png, application/octet-stream
+		if ( !conn->closed && tsnet_get_conn_id(tsnet, job->client_fd) == conn->conn_id ) (void)send_http_response(tsnet, job->client_fd, 200, "OK", job->path, "text/html", job->etag);
+
+		free(job);
+	}
+	conn->flushing = 0;
+
+	if ( conn->closed && !conn->head ) free(conn);
+}
+
+static void etag_work(void *arg)
+{
+	struct http_job *job = arg;
+
+	make_etag(job->path, job->etag);
+}
+
+static void etag_done(TSNET *tsnet, void *arg)
+{
+	struct http_job *job = arg;
+
+	job->done = 1;
+	flush_jobs(tsnet, job->conn);
+}
+
+/* jobs still running keep it (the last one frees it) */
+static void conn_free(void *conn_data)
+{
+	struct http_conn *conn = conn_data;
+
+	conn->closed = 1;
+	if ( !conn->head && !conn->flushing ) free(conn);
+}
+
 void accept_cb(TSNET *tsnet, socket_t client_fd, uint8_t *data, ssize_t data_len)
 {
 	struct tsnet_client client;
@@ -126,59 +167,75 @@ void accept_cb(TSNET *tsnet, socket_t client_fd, uint8_t *data, ssize_t data_len
 
 void recv_cb(TSNET *tsnet, socket_t client_fd, uint8_t *data, ssize_t data_len)
 {
-	size_t prevbuflen = 0;
 	struct http_request http_request;
-	struct http_request *http_request_p;
-	HashTableBucket *bucket;
-	HashTable *http_request_table = tsnet->user_data;
-
-	bucket = http_request_table->find(http_request_table, &client_fd, sizeof(client_fd));
-	if ( bucket ) {
-		http_request_p = bucket->value;
-		char *p = http_request_p->buf + http_request_p->received_len;
-
-		prevbuflen = http_request_p->received_len;
-		http_request_p->received_len += data_len;
-
-		memcpy(p, data, data_len);
-	} else {
-		memset(&http_request, 0x00, sizeof(http_request));
-		
-		http_request.received_len += data_len;
+	struct http_conn *conn;
+
+	if ( !(conn = tsnet_get_conn_data(tsnet, client_fd)) ) {
+		if ( !(conn = calloc(1, sizeof(struct http_conn))) ) {
+			fprintf(stderr, "calloc() is failed: (errmsg: %s, errno: %d)\n", strerror(errno), errno);
+			return;
+		}
+		conn->conn_id = tsnet_get_conn_id(tsnet, client_fd);
+		(void)tsnet_set_conn_data(tsnet, client_fd, conn);
+	}
+
+	// data is every unconsumed byte of this connection (tsnet input buffer), a pipelined packet can carry more than one request
+	while ( data_len > 0 ) {
 		http_request.num_headers = sizeof(http_request.headers) / sizeof(http_request.headers[0]);
-		
-		memcpy(http_request.buf, data, data_len);
-		
-		http_request_p = &http_request;
-	}
-		
-	// parse http headers
-	if ( phr_parse_request(http_request_p->buf, http_request_p->received_len, &http_request_p->method, &http_request_p->method_len, &http_request_p->path, &http_request_p->path_len, &http_request_p->minor_version, http_request_p->headers, &http_request_p->num_headers, prevbuflen) > 0 ) {
+
+		// parse http headers
+		int ret = phr_parse_request((const char *)data, data_len, &http_request.method, &http_request.method_len, &http_request.path, &http_request.path_len, &http_request.minor_version, http_request.headers, &http_request.num_headers, 0);
+		if ( ret == -2 ) break; // partial request, it stays buffered until the rest comes
+		if ( ret < 0 ) { // broken request, drop it
+			(void)tsnet_consume(tsnet, client_fd, data_len);
+			break;
+		}
+
 		char method[16] = {0};
 		char path[512] = {0};
 			
-		memcpy(method, http_request_p->method, http_request_p->method_len);
-		if ( http_request_p->path_len == 1 /* probably '/' */ ) {
+		memcpy(method, http_request.method, http_request.method_len < sizeof(method) ? http_request.method_len : sizeof(method) - 1);
+		if ( http_request.path_len == 1 /* probably '/' */ ) {
 			snprintf(path, sizeof(path), "./index.html");
 		} else {
 			path[0] = '.';
-			memcpy(path + 1, http_request_p->path, http_request_p->path_len);
+			memcpy(path + 1, http_request.path, http_request.path_len < sizeof(path) - 1 ? http_request.path_len : sizeof(path) - 2);
 		}
 		//printf("method: %s\n", method);
 		//printf("path:   %s\n", path);
 
-		for ( size_t i = 0; i < http_request_p->num_headers; i++ ) {
+		for ( size_t i = 0; i < http_request.num_headers; i++ ) {
 			char name[64] = {0};
 			char value[256] = {0};
 
-			memcpy(name, http_request_p->headers[i].name, http_request_p->headers[i].name_len);
-			memcpy(value, http_request_p->headers[i].value, http_request_p->headers[i].value_len);
+			memcpy(name, http_request.headers[i].name, http_request.headers[i].name_len < sizeof(name) ? http_request.headers[i].name_len : sizeof(name) - 1);
+			memcpy(value, http_request.headers[i].value, http_request.headers[i].value_len < sizeof(value) ? http_request.headers[i].value_len : sizeof(value) - 1);
 			//printf("name:   %s\n", name);
 			//printf("value:  %s\n", value);
 		}
 
-		//TODO: image/gif, image/jpeg, image/png, application/octet-stream
-		(void)send_http_response(tsnet, client_fd, 200, "OK", path, "text/html");
+		// the etag is hashed on a worker, the loop goes on with other connections meanwhile
+		struct http_job *job = calloc(1, sizeof(struct http_job));
+		if ( !job ) {
+			fprintf(stderr, "calloc() is failed: (errmsg: %s, errno: %d)\n", strerror(errno), errno);
+			break;
+		}
+		job->conn = conn;
+		job->client_fd = client_fd;
+		memcpy(job->path, path, sizeof(job->path));
+
+		if ( conn->tail ) conn->tail->next = job;
+		else conn->head = job;
+		conn->tail = job;
+
+		if ( tsnet_work(tsnet, etag_work, etag_done, job) < 0 ) {
+			etag_work(job); // no pool: on the loop as before
+			etag_done(tsnet, job);
+		}
+
+		(void)tsnet_consume(tsnet, client_fd, ret);
+		data += ret;
+		data_len -= ret;
 	}
 }
 
@@ -197,26 +254,29 @@ void close_cb(TSNET *tsnet, socket_t client_fd, uint8_t *data, ssize_t data_len)
 int main(int argc, char **argv)
 {
 	TSNET *tsnet = NULL;
-	HashTable *http_request_table = NULL;
+	int type = TSNET_EPOLL;
 
-	if ( argc != 2 ) {
-		fprintf(stderr, "%s (port)\n", argv[0]);
+	if ( argc < 2 || argc > 4 ) {
+		fprintf(stderr, "%s (port) [epoll | io_uring] [workers (default: online CPUs)]\n", argv[0]);
 		return 1;
 	}
 
-	tsnet = tsnet_create(TSNET_EPOLL, 0, 0);
+	if ( argc >= 3 && strcmp(argv[2], "io_uring") == 0 ) type = TSNET_IO_URING;
+
+	tsnet = tsnet_create(type, 0, 0);
 	if ( !tsnet ) {
 		fprintf(stderr, "%s\n", tsnet_get_last_error());
 		goto out;
 	}
 	
-	if ( !(http_request_table = ht_create(0, 0, 0)) ) {
+	(void)tsnet_set_recv_buffer(tsnet, MAX_HTTP_REQUEST); // a request larger than this closes the connection
+	tsnet_set_conn_data_free(tsnet, conn_free);
+
+	if ( tsnet_set_workers(tsnet, argc == 4 ? atoi(argv[3]) : 0) < 0 ) {
 		fprintf(stderr, "%s\n", tsnet_get_last_error());
 		goto out;
 	}
 
-	tsnet_set_user_data(tsnet, http_request_table);
-
 	if ( tsnet_bind(tsnet, "0.0.0.0", atoi(argv[1])) < 0 ) {
 		fprintf(stderr, "%s\n", tsnet_get_last_error());
 		goto out;
@@ -231,13 +291,11 @@ int main(int argc, char **argv)
 		goto out;
 	}
 
-	ht_delete(http_request_table);
 	tsnet_delete(tsnet);
 
 	return 0;
 
 out:
-	ht_delete(http_request_table);
 	tsnet_delete(tsnet);
 
 	return 1;
@@ -6,11 +6,10 @@
 #include "picohttpparser.h"
 
 #define MAX_HTTP_HEADER 64
+#define MAX_HTTP_REQUEST 65535
+#define ETAG_SIZE 65 /* sha256 hex + '\0' */
 
 struct http_request {
-	char buf[65535];
-	size_t received_len;
-	
 	const char *method, *path;
 	size_t method_len, path_len;
 	int minor_version;
@@ -30,6 +29,24 @@ Date: Thu, 19 Jun 2008 19:29:07 GMT\r\n
 \r\n
 #endif
 
+/* a request waiting for its etag (tsnet_work()) */
+struct http_job {
+	struct http_job *next;
+	struct http_conn *conn;
+	socket_t client_fd;
+	char done;
+	char path[512];
+	char etag[ETAG_SIZE];
+};
+
+/* connection data: pipelined requests are answered in order, whichever worker finishes first */
+struct http_conn {
+	struct http_job *head, *tail;
+	uint64_t conn_id; // tsnet_get_conn_id(): a job answers only this connection, not a new one on the same fd
+	char closed; // the connection is gone, running jobs free it
+	char flushing;
+};
+
 struct http_response {
 	char buf[65535];
 	size_t buf_len;
@@ -1,415 +1,2241 @@
 #include "tsnet.h"
 #include "tsnet_common_inter.h"
 #include "tsnet_epoll.h"
+#include "tsnet_io_uring.h"
+#include "tsnet_buffer.h"
+#include "tsnet_frame.h"
+#include "tsnet_timer.h"
+#include "tsnet_slab.h"
+#include "tsnet_post.h"
+#include "tsnet_pool.h"
+#include "tsnet_file.h"
+
+static void free_send_request(TSNET *tsnet, struct tsnet_send_request *srq)
+{
+	if ( srq ) {
+		if ( srq->send_type == TSNET_SEND_MEMORY ) {
+			if ( srq->free_fn ) srq->free_fn(srq->send_data, srq->free_arg);
+			else tsnet_slab_free(&tsnet->slab, srq->send_data, srq->send_len);
+			srq->send_data = NULL;
+		}
+		else if ( srq->send_type == TSNET_SEND_FILE ) {
+			if ( srq->file_read ) srq->file_read->srq = NULL; // an I/O worker still reads it, file_read_done() closes it
+			else safe_close(srq->sendfile_fd);
+			safe_close(srq->pipe_fd[0]);
+			safe_close(srq->pipe_fd[1]);
+		}
+		tsnet_slab_free(&tsnet->slab, srq, sizeof(struct tsnet_send_request));
+	}
+}
+
+static struct tsnet_conn * find_conn(TSNET *tsnet, socket_t client_fd)
+{
+	if ( client_fd < 0 || (size_t)client_fd >= tsnet->conns_size || !tsnet->conns[client_fd].in_use ) return NULL;
+
+	return &tsnet->conns[client_fd];
+}
+
+static struct tsnet_conn * get_conn(TSNET *tsnet, socket_t client_fd)
+{
+	struct tsnet_conn *conn;
+
+	if ( !(conn = find_conn(tsnet, client_fd)) ) {
+		TSNET_SET_ERROR("can not found (connection: fd = %d)", client_fd);
+		return NULL;
+	}
+
+	return conn;
+}
+
+static void conn_timer_cb(TSNET *tsnet, void *arg);
+
+/* earliest deadline of the connection timeouts (0: none), kind: enum tsnet_timeout_type of it */
+static uint64_t conn_deadline(struct tsnet_conn *conn, int *kind)
+{
+	uint64_t t, deadline = 0;
+
+	if ( conn->idle_timeout ) {
+		deadline = (conn->last_read > conn->last_write ? conn->last_read : conn->last_write) + conn->idle_timeout;
+		*kind = TSNET_TIMEOUT_IDLE;
+	}
+
+	t = conn->last_read + conn->read_timeout;
+	if ( conn->read_timeout && (!deadline || t < deadline) ) {
+		deadline = t;
+		*kind = TSNET_TIMEOUT_READ;
+	}
+
+	// only while something is queued
+	t = conn->last_write + conn->write_timeout;
+	if ( conn->write_timeout && conn->send_head && (!deadline || t < deadline) ) {
+		deadline = t;
+		*kind = TSNET_TIMEOUT_WRITE;
+	}
+
+	return deadline;
+}
+
+/* one timer per connection, armed for the earliest deadline (activity does not touch the wheel) */
+static int arm_conn_timer(TSNET *tsnet, struct tsnet_conn *conn)
+{
+	int kind;
+	uint64_t deadline = conn_deadline(conn, &kind);
+
+	if ( conn->timer ) {
+		if ( deadline && conn->timer->expire <= deadline ) return 0; // fires early and re-arms itself
+		tsnet_timer_stop(&tsnet->timers, conn->timer);
+		conn->timer = NULL;
+	}
+
+	if ( !deadline ) return 0;
+
+	if ( !(conn->timer = tsnet_timer_start(&tsnet->timers, deadline, conn_timer_cb, (void *)(intptr_t)conn->client.fd)) ) return -1;
+
+	return 0;
+}
+
+static struct tsnet_conn * add_conn(TSNET *tsnet, struct tsnet_client *client)
+{
+	struct tsnet_conn *conn;
+
+	// fds are small dense integers, grow the table until fd fits (slot address changes only here)
+	if ( (size_t)client->fd >= tsnet->conns_size ) {
+		size_t size = tsnet->conns_size ? tsnet->conns_size : (size_t)tsnet->max_client;
+		struct tsnet_conn *conns;
+
+		for ( ; size <= (size_t)client->fd; size = size << 1 ) {/* no action */}
+
+		if ( !(conns = realloc(tsnet->conns, size * sizeof(struct tsnet_conn))) ) {
+			TSNET_SET_ERROR("realloc() is failed: (errmsg: %s, errno: %d, size: %lu)", strerror(errno), errno, size * sizeof(struct tsnet_conn));
+			return NULL;
+		}
+
+		memset(conns + tsnet->conns_size, 0x00, (size - tsnet->conns_size) * sizeof(struct tsnet_conn));
+
+		tsnet->conns = conns;
+		tsnet->conns_size = size;
+	}
+
+	conn = &tsnet->conns[client->fd];
+
+	memset(conn, 0x00, sizeof(struct tsnet_conn));
+	memcpy(&conn->client, client, sizeof(struct tsnet_client));
+	conn->in_use = 1;
+	conn->id = ++tsnet->conn_id;
+	conn->recv_size = TSNET_INIT_RECV_BYTES;
+	conn->idle_timeout = tsnet->idle_timeout;
+	conn->read_timeout = tsnet->read_timeout;
+	conn->write_timeout = tsnet->write_timeout;
+	conn->last_read = conn->last_write = tsnet->now;
+
+	// the kernel keeps only this much unsent data, the send queue (and its watermarks) holds the rest
+	if ( tsnet->send_high || tsnet->total_high ) {
+		int lowat = TSNET_NOTSENT_LOWAT;
+
+		(void)setsockopt(client->fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &lowat, sizeof(lowat));
+	}
+
+	if ( arm_conn_timer(tsnet, conn) < 0 ) {
+		memset(conn, 0x00, sizeof(struct tsnet_conn));
+		return NULL;
+	}
+
+	return conn;
+}
+
+static void release_conn(TSNET *tsnet, struct tsnet_conn *conn)
+{
+	struct tsnet_send_request *srq, *srq_next;
+
+	if ( conn->user_data && tsnet->conn_data_free ) tsnet->conn_data_free(conn->user_data);
+
+	tsnet_input_release(&tsnet->slab, &conn->input);
+
+	tsnet->queued -= conn->queued;
+
+	if ( conn->timer ) tsnet_timer_stop(&tsnet->timers, conn->timer);
+
+	for ( srq = conn->send_head; srq; srq = srq_next ) {
+		srq_next = srq->next;
+		free_send_request(tsnet, srq);
+	}
+
+	// only with no completion pending (orphan_conn()), or after abort_zerocopy()
+	for ( srq = conn->zc_head; srq; srq = srq_next ) {
+		srq_next = srq->next;
+		free_send_request(tsnet, srq);
+	}
+
+	memset(conn, 0x00, sizeof(struct tsnet_conn));
+}
+
+static int update_events(TSNET *tsnet, struct tsnet_conn *conn, uint32_t events)
+{
+	if ( conn->events == events ) return 0;
+
+	if ( epoll_event_control(tsnet->epfd, EPOLL_CTL_MOD, conn->client.fd, events) < 0 ) {
+		TSNET_SET_ERROR("epoll_ctl(EPOLL_CTL_MOD, 0x%x) is failed: (errmsg: %s, errno: %d)", events, strerror(errno), errno);
+		return -1;
+	}
+
+	conn->events = events;
+
+	return 0;
+}
+
+static int fd_list_push(struct tsnet_fd_list *list, socket_t fd)
+{
+	if ( list->count == list->size ) {
+		size_t size = list->size ? list->size << 1 : 64;
+		socket_t *fds;
+
+		if ( !(fds = realloc(list->fds, size * sizeof(socket_t))) ) {
+			TSNET_SET_ERROR("realloc() is failed: (errmsg: %s, errno: %d, size: %lu)", strerror(errno), errno, size * sizeof(socket_t));
+			return -1;
+		}
+
+		list->fds = fds;
+		list->size = size;
+	}
+
+	list->fds[list->count++] = fd;
+
+	return 0;
+}
+
+static int uring_submit_recv(TSNET *tsnet, struct tsnet_conn *conn);
+
+/* epoll read interest of the connection */
+static uint32_t read_events(struct tsnet_conn *conn)
+{
+	return conn->paused ? 0 : EPOLLIN;
+}
+
+static int set_reading(TSNET *tsnet, struct tsnet_conn *conn)
+{
+	struct io_uring_sqe *sqe;
+
+	if ( tsnet->type != TSNET_IO_URING ) return update_events(tsnet, conn, (conn->events & ~EPOLLIN) | read_events(conn));
+
+	if ( !conn->paused ) return !conn->recv_armed && !conn->closing ? uring_submit_recv(tsnet, conn) : 0;
+
+	if ( !conn->recv_armed ) return 0;
+
+	// the multishot recv ends with -ECANCELED, it is not armed again while paused
+	if ( !(sqe = tsnet_uring_get_sqe(tsnet->uring)) ) return -1;
+
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->addr = TSNET_URING_DATA(TSNET_URING_RECV, conn->client.fd);
+	sqe->user_data = TSNET_URING_DATA(TSNET_URING_CANCEL, conn->client.fd);
+
+	return 0;
+}
+
+static int pause_reading(TSNET *tsnet, struct tsnet_conn *conn, char reason)
+{
+	char paused = conn->paused;
+
+	conn->paused |= reason;
+
+	return paused ? 0 : set_reading(tsnet, conn);
+}
+
+static int resume_reading(TSNET *tsnet, struct tsnet_conn *conn, char reason)
+{
+	if ( !(conn->paused & reason) ) return 0;
+
+	if ( (conn->paused &= ~reason) ) return 0; // still over the other watermark
+
+	if ( set_reading(tsnet, conn) < 0 ) return -1;
+
+	if ( tsnet->cb_vec[TSNET_EVENT_WRITABLE_LOW] ) tsnet->cb_vec[TSNET_EVENT_WRITABLE_LOW](tsnet, conn->client.fd, NULL, 0);
+
+	return 0;
+}
+
+/* memory request of len bytes is queued, stop reading the client that crosses a high watermark */
+static void account_queued(TSNET *tsnet, struct tsnet_conn *conn, size_t len)
+{
+	conn->queued += len;
+	tsnet->queued += len;
+
+	// flow control only, a failure here does not fail the send
+	if ( tsnet->send_high && conn->queued >= tsnet->send_high ) (void)pause_reading(tsnet, conn, TSNET_PAUSE_CONN);
+
+	if ( tsnet->total_high && tsnet->queued >= tsnet->total_high && !(conn->paused & TSNET_PAUSE_TOTAL) ) {
+		if ( fd_list_push(&tsnet->paused_list, conn->client.fd) == 0 ) (void)pause_reading(tsnet, conn, TSNET_PAUSE_TOTAL);
+	}
+}
+
+static int account_sent(TSNET *tsnet, struct tsnet_conn *conn, size_t len)
+{
+	conn->queued -= len;
+	tsnet->queued -= len;
+
+	if ( conn->paused & TSNET_PAUSE_CONN && conn->queued <= tsnet->send_low ) return resume_reading(tsnet, conn, TSNET_PAUSE_CONN);
+
+	return 0;
+}
+
+/* the event loop queues drained below the total low watermark */
+static int resume_paused(TSNET *tsnet)
+{
+	struct tsnet_conn *conn;
+	struct tsnet_fd_list *list = &tsnet->paused_list;
+	size_t count = list->count;
+
+	// WRITABLE_LOW callbacks may pause clients again, they are appended behind
+	for ( size_t i = 0; i < count; i++ ) {
+		if ( (conn = find_conn(tsnet, list->fds[i])) && resume_reading(tsnet, conn, TSNET_PAUSE_TOTAL) < 0 ) {
+			list->count = 0;
+			return -1;
+		}
+	}
+
+	memmove(list->fds, list->fds + count, (list->count - count) * sizeof(socket_t));
+	list->count -= count;
+
+	return 0;
+}
+
+static void send_queue_pop(TSNET *tsnet, struct tsnet_conn *conn)
+{
+	struct tsnet_send_request *srq = conn->send_head;
+
+	if ( !(conn->send_head = srq->next) ) conn->send_tail = NULL;
+
+	if ( srq->zc_refs ) { // the kernel still reads send_data, keep it until the completion
+		srq->next = NULL;
+		if ( conn->zc_tail ) conn->zc_tail->next = srq;
+		else conn->zc_head = srq;
+		conn->zc_tail = srq;
+		return;
+	}
+
+	free_send_request(tsnet, srq);
+}
+
+/* number of notification ids in lo ~ hi used by srq (ids wrap around) */
+static uint32_t zerocopy_overlap(struct tsnet_send_request *srq, uint32_t lo, uint32_t hi)
+{
+	uint32_t first, last;
+
+	if ( srq->zc_count == 0 ) return 0;
+
+	first = (int32_t)(lo - srq->zc_first) > 0 ? lo : srq->zc_first;
+	last = (int32_t)(hi - (srq->zc_first + srq->zc_count - 1)) < 0 ? hi : srq->zc_first + srq->zc_count - 1;
+
+	return (int32_t)(last - first) >= 0 ? last - first + 1 : 0;
+}
+
+static void zerocopy_complete(TSNET *tsnet, struct tsnet_conn *conn, uint32_t lo, uint32_t hi, char copied)
+{
+	struct tsnet_send_request *srq, *prev = NULL, *next;
+
+	if ( copied ) conn->zc_copied += hi - lo + 1;
+
+	// the head may be partially sent, its completed ids are counted now
+	if ( (srq = conn->send_head) && srq->zc_refs ) srq->zc_refs -= zerocopy_overlap(srq, lo, hi);
+
+	// completions are usually in order, but it is not guaranteed
+	for ( srq = conn->zc_head; srq; srq = next ) {
+		next = srq->next;
+		srq->zc_refs -= zerocopy_overlap(srq, lo, hi);
+
+		if ( srq->zc_refs ) {
+			prev = srq;
+			continue;
+		}
+
+		if ( prev ) prev->next = next;
+		else conn->zc_head = next;
+		if ( conn->zc_tail == srq ) conn->zc_tail = prev;
+
+		free_send_request(tsnet, srq);
+	}
+}
+
+/* read MSG_ZEROCOPY completions from the socket error queue (reported as EPOLLERR) */
+static int recv_zerocopy_completions(TSNET *tsnet, struct tsnet_conn *conn)
+{
+	char control[128];
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	struct sock_extended_err *serr;
+
+	while (1) {
+		memset(&msg, 0x00, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		if ( recvmsg(conn->client.fd, &msg, MSG_ERRQUEUE) < 0 ) {
+			if ( errno == EINTR ) continue;
+			if ( errno == EWOULDBLOCK ) return 0;
+
+			TSNET_SET_ERROR("recvmsg(MSG_ERRQUEUE) is failed: (errmsg: %s, errno: %d, fd: %d)", strerror(errno), errno, conn->client.fd);
+			return -1;
+		}
+
+		for ( cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg) ) {
+			if ( !(cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) && !(cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR) ) continue;
+
+			serr = (struct sock_extended_err *)CMSG_DATA(cmsg);
+			if ( serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY ) continue;
+
+			zerocopy_complete(tsnet, conn, serr->ee_info, serr->ee_data, serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED);
+		}
+	}
+}
+
+/* the kernel still holds pages of a MSG_ZEROCOPY request (sent ones, or a partly sent head) */
+static inline int zerocopy_pinned(struct tsnet_conn *conn)
+{
+	return conn->zc_head || (conn->send_head && conn->send_head->zc_refs);
+}
+
+/* tsnet_delete(): no completion is waited for, an abortive close drops the queued data before the pages are freed */
+static void abort_zerocopy(struct tsnet_conn *conn)
+{
+	struct linger linger = { 1, 0 };
+
+	if ( !zerocopy_pinned(conn) ) return;
+
+	(void)setsockopt(conn->client.fd, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger));
+	close(conn->client.fd);
+}
+
+/* the connection is closed for the user, but the fd stays open (a reused fd would lose the completions) until the kernel
+ * releases the pages of its zerocopy requests: queued data is still sent, then acked, then completed */
+static int orphan_conn(TSNET *tsnet, struct tsnet_conn *conn)
+{
+	struct tsnet_send_request *srq, *zc_head, *zc_tail;
+	socket_t client_fd = conn->client.fd;
+
+	// a partly sent head goes with the sent ones
+	if ( (srq = conn->send_head) && srq->zc_refs ) {
+		if ( !(conn->send_head = srq->next) ) conn->send_tail = NULL;
+		srq->next = NULL;
+		if ( conn->zc_tail ) conn->zc_tail->next = srq;
+		else conn->zc_head = srq;
+		conn->zc_tail = srq;
+	}
+
+	zc_head = conn->zc_head;
+	zc_tail = conn->zc_tail;
+	conn->zc_head = conn->zc_tail = NULL;
+
+	release_conn(tsnet, conn);
+
+	conn->client.fd = client_fd;
+	conn->zc_head = zc_head;
+	conn->zc_tail = zc_tail;
+	conn->closing = 1;
+
+	(void)shutdown(client_fd, SHUT_RDWR);
+
+	// EPOLLERR (completions) and EPOLLHUP are always reported, edge triggered a hung up socket does not wake every turn
+	if ( epoll_event_control(tsnet->epfd, EPOLL_CTL_MOD, client_fd, EPOLLET) < 0 ) {
+		TSNET_SET_ERROR("epoll_ctl(EPOLL_CTL_MOD) is failed: (errmsg: %s, errno: %d)", strerror(errno), errno);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* an event of an orphaned connection: it is closed with the last completion */
+static int orphan_event(TSNET *tsnet, struct tsnet_conn *conn)
+{
+	socket_t client_fd = conn->client.fd;
+
+	// the error queue can't be read any more: nothing more is completed, the queued data is dropped instead
+	if ( recv_zerocopy_completions(tsnet, conn) < 0 ) abort_zerocopy(conn);
+	else if ( conn->zc_head ) return 0;
+	else {
+		if ( epoll_event_control(tsnet->epfd, EPOLL_CTL_DEL, client_fd, 0) < 0 ) {
+			TSNET_SET_ERROR("epoll_ctl(EPOLL_CTL_DEL) is failed: (errmsg: %s, errno: %d)", strerror(errno), errno);
+			return -1;
+		}
+		close(client_fd);
+	}
+
+	release_conn(tsnet, conn);
+
+	return 0;
+}
+
+static int close_client(TSNET *tsnet, int client_fd)
+{
+	struct tsnet_conn *conn;
+
+	// the fd stays in the epoll set for the completions
+	if ( (conn = find_conn(tsnet, client_fd)) && zerocopy_pinned(conn) ) {
+		if ( tsnet->cb_vec[TSNET_EVENT_CLOSE] ) tsnet->cb_vec[TSNET_EVENT_CLOSE](tsnet, client_fd, NULL, 0);
+
+		return orphan_conn(tsnet, conn);
+	}
+
+	if ( epoll_event_control(tsnet->epfd, EPOLL_CTL_DEL, client_fd, 0) < 0 ) {
+		TSNET_SET_ERROR("epoll_ctl(EPOLL_CTL_DEL) is failed: (errmsg: %s, errno: %d)", strerror(errno), errno);
+		goto out;
+	}
+
+	if ( tsnet->cb_vec[TSNET_EVENT_CLOSE] ) tsnet->cb_vec[TSNET_EVENT_CLOSE](tsnet, client_fd, NULL, 0);
+	
+	if ( !(conn = get_conn(tsnet, client_fd)) ) goto out;
+
+	release_conn(tsnet, conn);
+	
+	safe_close(client_fd);
+						
+	return 0;
+
+out:
+	return -1;
+}
+
+static int complete_send_request(TSNET *tsnet, struct tsnet_conn *conn, int client_fd)
+{
+	send_queue_pop(tsnet, conn);
+	
+	if ( !tsnet->edge_trigger && !conn->send_head && update_events(tsnet, conn, read_events(conn)) < 0 ) return -1;
+
+	if ( tsnet->cb_vec[TSNET_EVENT_SEND_COMPLETE] ) tsnet->cb_vec[TSNET_EVENT_SEND_COMPLETE](tsnet, client_fd, NULL, 0);
+
+	return 0;
+}
+
+/* send the MSG_ZEROCOPY request at the head of the queue (alone, it is not gathered) */
+static int send_zerocopy_to_client(TSNET *tsnet, struct tsnet_conn *conn, int client_fd)
+{
+	ssize_t nsend;
+	int flags = MSG_ZEROCOPY | MSG_NOSIGNAL;
+	struct tsnet_send_request *srq = conn->send_head;
+
+	while ( srq->sended_len < srq->send_len ) {
+		if ( (nsend = send(client_fd, srq->send_data + srq->sended_len, srq->send_len - srq->sended_len, flags)) < 0 ) {
+			if ( errno == EINTR ) continue;
+			if ( errno == EWOULDBLOCK ) return 0;
+			if ( errno == ENOBUFS && (flags & MSG_ZEROCOPY) ) { // optmem limit (too many pending notifications), copy this time
+				flags &= ~MSG_ZEROCOPY;
+				conn->zc_copied++;
+				continue;
+			}
+
+			TSNET_SET_ERROR("send(MSG_ZEROCOPY) is failed: (nsend: %ld, errmsg: %s, errno: %d, srq->fd: %d, srq->send_len: %lu, srq->sended_len: %lu)", nsend, strerror(errno), errno, srq->fd, srq->send_len, srq->sended_len);
+			return -1;
+		}
+
+		if ( flags & MSG_ZEROCOPY ) { // every successful call takes the next notification id
+			if ( srq->zc_count++ == 0 ) srq->zc_first = conn->zc_next_id;
+			conn->zc_next_id++;
+			conn->zc_sends++;
+			srq->zc_refs++;
+		}
+
+		srq->sended_len += nsend;
+		conn->last_write = tsnet->now;
+
+		if ( account_sent(tsnet, conn, nsend) < 0 ) return -1;
+	}
+
+	if ( complete_send_request(tsnet, conn, client_fd) < 0 ) return -1;
+
+	return 1;
+}
+
+/* send the memory requests at the head of the queue with one sendmsg() (up to TSNET_MAX_IOV requests) */
+static int send_memory_to_client(TSNET *tsnet, struct tsnet_conn *conn, int client_fd)
+{
+	int ret, iovcnt;
+	size_t total;
+	ssize_t nsend;
+	struct iovec iov[TSNET_MAX_IOV];
+	struct msghdr msg;
+	struct tsnet_send_request *srq;
+
+	while (1) {
+		if ( (srq = conn->send_head) && srq->send_type == TSNET_SEND_MEMORY && srq->zerocopy ) {
+			if ( (ret = send_zerocopy_to_client(tsnet, conn, client_fd)) <= 0 ) return ret;
+			continue;
+		}
+
+		total = 0;
+		for ( iovcnt = 0, srq = conn->send_head; srq && srq->send_type == TSNET_SEND_MEMORY && !srq->zerocopy && iovcnt < TSNET_MAX_IOV; srq = srq->next, iovcnt++ ) {
+			iov[iovcnt].iov_base = srq->send_data + srq->sended_len;
+			iov[iovcnt].iov_len = srq->send_len - srq->sended_len;
+			total += iov[iovcnt].iov_len;
+		}
+
+		if ( iovcnt == 0 ) return 1; // queue is empty or a file request is next (a zerocopy request is sent by the next turn)
+
+		memset(&msg, 0x00, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = iovcnt;
+
+		if ( (nsend = sendmsg(client_fd, &msg, MSG_NOSIGNAL)) < 0 ) {
+			if ( errno == EINTR ) continue;
+			if ( errno == EWOULDBLOCK ) return 0;
+
+			srq = conn->send_head;
+			TSNET_SET_ERROR("sendmsg() is failed: (nsend: %ld, errmsg: %s, errno: %d, srq->fd: %d, iovcnt: %d, total: %lu)", nsend, strerror(errno), errno, srq->fd, iovcnt, total);
+			return -1;
+		}
+
+		if ( nsend > 0 ) conn->last_write = tsnet->now;
+
+		// a partial write can end in the middle of any request
+		for ( size_t left = nsend; left > 0; ) {
+			size_t remain;
+
+			srq = conn->send_head;
+			remain = srq->send_len - srq->sended_len;
+
+			if ( left < remain ) {
+				srq->sended_len += left;
+				if ( account_sent(tsnet, conn, left) < 0 ) return -1;
+				break;
+			}
+
+			srq->sended_len = srq->send_len;
+			left -= remain;
+
+			if ( account_sent(tsnet, conn, remain) < 0 ) return -1;
+
+			if ( complete_send_request(tsnet, conn, client_fd) < 0 ) return -1;
+		}
+
+		if ( (size_t)nsend < total ) return 0; // socket buffer is full
+	}
+}
+
+/* level triggered: no EPOLLOUT while the file is read (it would be reported at every turn) */
+static int wait_file_read(TSNET *tsnet, struct tsnet_conn *conn)
+{
+	return tsnet->edge_trigger ? 0 : update_events(tsnet, conn, read_events(conn));
+}
+
+/* loop thread: the window is in page cache now (or the read failed, then sendfile() reports it) */
+static void file_read_done(TSNET *tsnet, void *arg)
+{
+	struct tsnet_file_read *file_read = arg;
+	struct tsnet_send_request *srq = file_read->srq;
+	struct tsnet_conn *conn;
+
+	if ( !srq ) { // the connection is gone
+		close(file_read->file_fd);
+		return;
+	}
+
+	srq->file_read = NULL;
+	srq->cached_len += file_read->len;
+
+	if ( !(conn = find_conn(tsnet, file_read->fd)) ) return;
+
+	if ( tsnet->edge_trigger ) {
+		if ( fd_list_push(&tsnet->flush_list, file_read->fd) < 0 ) (void)close_client(tsnet, file_read->fd);
+	}
+	else if ( update_events(tsnet, conn, read_events(conn) | EPOLLOUT) < 0 ) (void)close_client(tsnet, file_read->fd);
+}
+
+/* one I/O pool for every loop, started by the first cold window (a server that sends no cold file starts no thread) */
+static struct tsnet_pool * get_io_pool(TSNET *tsnet)
+{
+	TSNET *root = tsnet->parent ? tsnet->parent : tsnet;
+	struct tsnet_pool *pool, *running = NULL;
+
+	if ( (pool = __atomic_load_n(&root->io_pool, __ATOMIC_ACQUIRE)) ) return pool;
+
+	if ( !(pool = tsnet_pool_create(root, root->io_workers)) ) {
+		tsnet->io_workers = 0; // this loop sends without the pool from now on
+		return NULL;
+	}
+
+	// another loop started one meanwhile
+	if ( !__atomic_compare_exchange_n(&root->io_pool, &running, pool, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) ) {
+		tsnet_pool_delete(pool);
+		return running;
+	}
+
+	return pool;
+}
+
+/* 1: the next window of the file can be sent, 0: it is cold and read on the I/O pool first, -1: error */
+static int check_file_window(TSNET *tsnet, struct tsnet_conn *conn, struct tsnet_send_request *srq)
+{
+	size_t len = srq->send_len - srq->sended_len < TSNET_SENDFILE_WINDOW ? srq->send_len - srq->sended_len : TSNET_SENDFILE_WINDOW;
+	struct tsnet_file_read *file_read;
+	struct tsnet_pool *pool;
+
+	if ( tsnet_file_resident(srq->sendfile_fd, srq->sended_len, len) ) {
+		srq->cached_len += len;
+		return 1;
+	}
+
+	// malloc(): the loop frees it as a post
+	if ( !(pool = get_io_pool(tsnet)) || !(file_read = calloc(1, sizeof(struct tsnet_file_read))) ) {
+		srq->cached_len += len; // can't wait for it: sendfile() reads it on the loop as before
+		return 1;
+	}
+
+	file_read->work.post.fn = file_read_done;
+	file_read->work.post.arg = file_read;
+	file_read->work.work = tsnet_file_warm;
+	file_read->work.loop = tsnet;
+	file_read->file_fd = srq->sendfile_fd;
+	file_read->offset = srq->sended_len;
+	file_read->len = len;
+	file_read->fd = srq->fd;
+	file_read->srq = srq;
+
+	if ( tsnet_pool_submit(pool, &file_read->work) < 0 ) {
+		free(file_read);
+		srq->cached_len += len;
+		return 1;
+	}
+
+	srq->file_read = file_read;
+
+	return wait_file_read(tsnet, conn) < 0 ? -1 : 0;
+}
+
+static int send_data_to_client(TSNET *tsnet, struct tsnet_conn *conn, int client_fd /* same srq->fd */)
+{
+	ssize_t nsend;
+	struct tsnet_send_request *srq;
+
+	srq = conn->send_head;
+	
+	if ( srq->send_type == TSNET_SEND_MEMORY ) {
+		int ret;
+
+		if ( (ret = send_memory_to_client(tsnet, conn, client_fd)) < 0 ) goto out;
+
+		return ret;
+	}
+	else if ( srq->send_type == TSNET_SEND_FILE ) {
+		do {
+			// sendfile() blocks the loop on pages not in page cache: each window is checked first (I/O pool)
+			if ( tsnet->io_workers > 0 && srq->sended_len == srq->cached_len ) {
+				int ret;
+
+				if ( srq->file_read ) { // resumed by file_read_done()
+					if ( wait_file_read(tsnet, conn) < 0 ) goto out;
+					return 0;
+				}
+
+				if ( (ret = check_file_window(tsnet, conn, srq)) < 0 ) goto out;
+				if ( ret == 0 ) return 0;
+			}
+
+			nsend = sendfile(client_fd, srq->sendfile_fd /* offset auto move */, NULL, (tsnet->io_workers > 0 ? srq->cached_len : srq->send_len) - srq->sended_len);
+			//printf("sendfile nsend: %ld\n", nsend);
+			if ( nsend > 0 ) {
+				srq->sended_len += nsend;
+				conn->last_write = tsnet->now;
+			}
+		} while ( nsend > 0 && srq->sended_len < srq->send_len );
+	}
+	else { // it never happens, but i put in the code just in case 
+		TSNET_SET_ERROR("invalid send type (type: %d)", srq->send_type);
+		goto out;
+	}
+	
+	if ( nsend < 0 ) {
+		if ( errno != EWOULDBLOCK ) {
+			TSNET_SET_ERROR("sendfile() is failed: (nsend: %ld, errmsg: %s, errno: %d, srq->fd: %d, srq->send_len: %lu, srq->sended_len: %lu)", nsend, strerror(errno), errno, srq->fd, srq->send_len, srq->sended_len);
+			goto out;
+		}
+	}
+	
+	if ( srq->send_len != srq->sended_len ) return 0;
+
+	// sending is completed
+	if ( complete_send_request(tsnet, conn, client_fd) < 0 ) goto out;
+
+	return 1;
+
+out:
+	(void)close_client(tsnet, client_fd); // the send queue is freed with the connection
+
+	return -1;
+}
+
+static int flush_send_queue(TSNET *tsnet, socket_t client_fd)
+{
+	int ret;
+	struct tsnet_conn *conn;
+
+	if ( !(conn = get_conn(tsnet, client_fd)) ) return 0; // closed after its send request
+
+	// edge triggered: EPOLLOUT is reported again only after the socket buffer fills up, so send until then
+	while ( conn->send_head ) {
+		if ( (ret = send_data_to_client(tsnet, conn, client_fd)) <= 0 ) return ret;
+	}
+
+	return 0;
+}
+
+static int flush_pending_sends(TSNET *tsnet)
+{
+	struct tsnet_fd_list *list = &tsnet->flush_list;
+
+	// callbacks may append while flushing, so walk by index
+	for ( size_t i = 0; i < list->count; i++ ) {
+		if ( flush_send_queue(tsnet, list->fds[i]) < 0 ) {
+			list->count = 0;
+			return -1;
+		}
+	}
+
+	list->count = 0;
+
+	return 0;
+}
+
+static void fire_send_complete(TSNET *tsnet)
+{
+	struct tsnet_fd_list *list = &tsnet->complete_list;
+
+	for ( size_t i = 0; i < list->count; i++ ) {
+		socket_t client_fd = list->fds[i];
+
+		// skip the connection closed after its tsnet_send()
+		if ( !find_conn(tsnet, client_fd) ) continue;
+
+		if ( tsnet->cb_vec[TSNET_EVENT_SEND_COMPLETE] ) tsnet->cb_vec[TSNET_EVENT_SEND_COMPLETE](tsnet, client_fd, NULL, 0);
+	}
+
+	list->count = 0;
+}
+
+/* event_fd was signaled: up to TSNET_POST_BATCH posts, the loop wakes itself up again when more are left */
+static int run_posts(TSNET *tsnet)
+{
+	struct tsnet_post *post;
+	struct tsnet_conn *conn;
+
+	tsnet_post_ack(&tsnet->posts);
+
+	for ( int i = 0; i < TSNET_POST_BATCH && (post = tsnet_post_pop(&tsnet->posts)); i++ ) {
+		if ( post->fn ) post->fn(tsnet, post->arg);
+		// the client can be gone by now, or its fd taken by a new one
+		else if ( (conn = find_conn(tsnet, post->fd)) && conn->id == post->conn_id ) (void)tsnet_send(tsnet, post->fd, post->data, post->data_len);
+
+		free(post);
+	}
+
+	// a push not linked yet is also picked up by the next turn
+	if ( !tsnet_post_empty(&tsnet->posts) ) return tsnet_post_wakeup(&tsnet->posts);
+
+	return 0;
+}
+
+/* EPOLLHUP or EPOLLERR: returns 0 when it was only MSG_ZEROCOPY completions, 1 when the client is closed */
+static int error_event(TSNET *tsnet, socket_t client_fd, unsigned int event)
+{
+	int err = 0;
+	socklen_t err_len = sizeof(err);
+	struct tsnet_conn *conn;
+
+	if ( !(event & EPOLLHUP) && (conn = find_conn(tsnet, client_fd)) && conn->zerocopy ) {
+		if ( recv_zerocopy_completions(tsnet, conn) == 0 && getsockopt(client_fd, SOL_SOCKET, SO_ERROR, &err, &err_len) == 0 && err == 0 ) return 0;
+	}
+
+	if ( close_client(tsnet, client_fd) < 0 ) return -1;
+
+	return 1;
+}
+
+static void adapt_recv_size(struct tsnet_conn *conn, size_t nrecv, size_t recv_size)
+{
+	if ( nrecv == recv_size ) { // more is probably waiting
+		if ( conn->recv_size < TSNET_MAX_RECV_BYTES ) conn->recv_size <<= 1;
+		conn->recv_small = 0;
+	}
+	else if ( nrecv <= conn->recv_size >> 1 && conn->recv_size > TSNET_MIN_RECV_BYTES ) {
+		if ( ++conn->recv_small >= 2 ) {
+			conn->recv_size >>= 1;
+			conn->recv_small = 0;
+		}
+	}
+	else conn->recv_small = 0;
+}
+
+static void set_rcvlowat(struct tsnet_conn *conn, size_t need)
+{
+	int lowat = need > TSNET_MAX_RCVLOWAT ? TSNET_MAX_RCVLOWAT : need ? (int)need : 1;
+
+	if ( (conn->rcvlowat ? conn->rcvlowat : 1) == lowat ) return;
+
+	// only an optimization, the frame is still completed by the recv loop when it fails
+	if ( setsockopt(conn->client.fd, SOL_SOCKET, SO_RCVLOWAT, &lowat, sizeof(lowat)) == 0 ) conn->rcvlowat = lowat;
+}
+
+/* call TSNET_EVENT_FRAME for every whole frame in the input buffer (consumed by tsnet) */
+static int deliver_frames(TSNET *tsnet, struct tsnet_conn *conn)
+{
+	int ret;
+	size_t offset, payload_len, frame_len;
+	struct tsnet_input *input = &conn->input;
+
+	while ( (ret = tsnet_frame_decode(&tsnet->framing, input->buf + input->start, input->end - input->start, &conn->frame_scan, &offset, &payload_len, &frame_len)) > 0 ) {
+		if ( tsnet->cb_vec[TSNET_EVENT_FRAME] ) tsnet->cb_vec[TSNET_EVENT_FRAME](tsnet, conn->client.fd, input->buf + input->start + offset, payload_len);
+		input->start += frame_len;
+	}
+
+	if ( ret < 0 ) {
+		TSNET_SET_ERROR("broken or too large frame: (fd: %d, type: %d, max size: %lu)", conn->client.fd, tsnet->framing.type, tsnet->framing.size);
+		return -1;
+	}
+
+	// the kernel wakes us when the pending frame can be complete, not for every segment of it
+	if ( tsnet->type == TSNET_EPOLL ) set_rcvlowat(conn, frame_len ? frame_len - (input->end - input->start) : 0);
+
+	return 0;
+}
+
+/* input buffer: the callback gets every unconsumed byte and calls tsnet_consume() (returns -1 to close the client) */
+static int deliver_input(TSNET *tsnet, struct tsnet_conn *conn)
+{
+	struct tsnet_input *input = &conn->input;
+
+	if ( tsnet->framing.type ) {
+		if ( deliver_frames(tsnet, conn) < 0 ) return -1;
+	}
+	else if ( tsnet->cb_vec[TSNET_EVENT_RECV] ) tsnet->cb_vec[TSNET_EVENT_RECV](tsnet, conn->client.fd, input->buf + input->start, input->end - input->start);
+	else input->start = input->end;
+
+	// released after the callback, it may still use the bytes it consumed
+	if ( input->start == input->end ) tsnet_input_release(&tsnet->slab, input);
+
+	return 0;
+}
+
+/* returns 1 when the client is closed */
+static int recv_data_from_client(TSNET *tsnet, socket_t client_fd, uint8_t *recv_buffer)
+{
+	ssize_t nrecv;
+	size_t recv_size, budget = TSNET_RECV_BUDGET;
+	struct tsnet_conn *conn;
+
+	if ( !(conn = get_conn(tsnet, client_fd)) ) return -1;
+
+	// a callback that queues over the high watermark stops the reading (edge triggered: EPOLLIN is added back on resume)
+	while ( budget > 0 && !conn->paused ) {
+		uint8_t *dst = recv_buffer; // recv_buffer is not cleared, callbacks get only the first nrecv bytes
+
+		recv_size = conn->recv_size;
+
+		if ( tsnet->input_limit ) { // read straight into the connection input buffer
+			if ( conn->input.end - conn->input.start >= tsnet->input_limit ) goto close; // never consumed, drop the client
+			if ( tsnet_input_reserve(&tsnet->slab, &conn->input, TSNET_MIN_RECV_BYTES) < 0 ) return -1;
+
+			dst = conn->input.buf + conn->input.end;
+			if ( recv_size > conn->input.size - conn->input.end ) recv_size = conn->input.size - conn->input.end;
+		}
+
+		nrecv = recv(client_fd, dst, recv_size, 0);
+		if ( nrecv > 0 ) {
+			conn->last_read = tsnet->now;
+			adapt_recv_size(conn, nrecv, recv_size);
+			budget -= (size_t)nrecv < budget ? (size_t)nrecv : budget;
+
+			if ( tsnet->input_limit ) {
+				conn->input.end += nrecv;
+				if ( deliver_input(tsnet, conn) < 0 ) goto close;
+			}
+			else if ( tsnet->cb_vec[TSNET_EVENT_RECV] ) tsnet->cb_vec[TSNET_EVENT_RECV](tsnet, client_fd, recv_buffer, nrecv);
+
+			// a short read drained the socket buffer, new data makes a new event (no recv() just for EWOULDBLOCK)
+			if ( (size_t)nrecv < recv_size ) return 0;
+		}
+		else if ( nrecv < 0 && (errno == EWOULDBLOCK || errno == EINTR) ) {
+			if ( errno == EWOULDBLOCK ) return 0;
+		}
+		else goto close; // peer closed or error
+	}
+
+	// budget is used up with data left: level triggered epoll reports it again, edge triggered does not
+	if ( tsnet->edge_trigger && !conn->paused && fd_list_push(&tsnet->read_list, client_fd) < 0 ) return -1;
+
+	return 0;
+
+close:
+	if ( close_client(tsnet, client_fd) < 0 ) return -1;
+
+	return 1;
+}
+
+static int resume_reads(TSNET *tsnet, uint8_t *recv_buffer)
+{
+	struct tsnet_fd_list *list = &tsnet->read_list;
+	size_t count = list->count;
+
+	// a client that uses up its budget again is appended behind, for the next turn
+	for ( size_t i = 0; i < count; i++ ) {
+		if ( find_conn(tsnet, list->fds[i]) && recv_data_from_client(tsnet, list->fds[i], recv_buffer) < 0 ) {
+			list->count = 0;
+			return -1;
+		}
+	}
+
+	memmove(list->fds, list->fds + count, (list->count - count) * sizeof(socket_t));
+	list->count -= count;
+
+	return 0;
+}
+
+static int get_client_info(socket_t client_fd, struct tsnet_client *client)
+{
+	struct sockaddr_in caddr;
+	socklen_t caddr_len = sizeof(caddr);
+
+	if ( getpeername(client_fd, (struct sockaddr *)&caddr, &caddr_len) < 0 ) {
+		TSNET_SET_ERROR("getpeername() is failed: (errmsg: %s, errno: %d)\n", strerror(errno), errno);
+		goto out;
+	}
+
+	if ( !inet_ntop(AF_INET, &caddr.sin_addr, client->ip, sizeof(client->ip)) ) {
+		TSNET_SET_ERROR("inet_ntop() is failed: (errmsg: %s, errno: %d)\n", strerror(errno), errno);
+		goto out;
+	}
+
+	client->fd = client_fd;
+	client->port = ntohs(caddr.sin_port);
+
+	return 0;
+
+out:
+	return -1;
+}
+
+static int uring_submit_accept(TSNET *tsnet)
+{
+	struct io_uring_sqe *sqe;
+
+	if ( !(sqe = tsnet_uring_get_sqe(tsnet->uring)) ) return -1;
+
+	// client sockets stay blocking, splice() to them runs on io-wq workers
+	sqe->opcode = IORING_OP_ACCEPT;
+	sqe->fd = tsnet->fd;
+	sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+	sqe->user_data = TSNET_URING_DATA(TSNET_URING_ACCEPT, tsnet->fd);
+
+	return 0;
+}
+
+/* one shot poll of event_fd, armed again after the posts run */
+static int uring_submit_wakeup(TSNET *tsnet)
+{
+	struct io_uring_sqe *sqe;
+
+	if ( !(sqe = tsnet_uring_get_sqe(tsnet->uring)) ) return -1;
+
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = tsnet->posts.event_fd;
+	sqe->poll32_events = POLLIN;
+	sqe->user_data = TSNET_URING_DATA(TSNET_URING_WAKEUP, tsnet->posts.event_fd);
+
+	return 0;
+}
+
+static int uring_submit_recv(TSNET *tsnet, struct tsnet_conn *conn)
+{
+	socket_t client_fd = conn->client.fd;
+	struct io_uring_sqe *sqe;
+
+	if ( !(sqe = tsnet_uring_get_sqe(tsnet->uring)) ) return -1;
+
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = client_fd;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = TSNET_URING_BUF_GROUP;
+	sqe->user_data = TSNET_URING_DATA(TSNET_URING_RECV, client_fd);
+
+	conn->recv_armed = 1;
+	conn->inflight++;
+
+	return 0;
+}
+
+static int uring_submit_send(TSNET *tsnet, struct tsnet_conn *conn)
+{
+	socket_t client_fd = conn->client.fd;
+	struct tsnet_send_request *srq;
+	struct io_uring_sqe *sqe;
+
+	if ( !(srq = conn->send_head) ) return 0; // nothing to send
+
+	if ( srq->send_type == TSNET_SEND_MEMORY ) {
+		if ( !(sqe = tsnet_uring_get_sqe(tsnet->uring)) ) return -1;
+
+		sqe->opcode = IORING_OP_SEND;
+		sqe->fd = client_fd;
+		sqe->addr = (uint64_t)(uintptr_t)(srq->send_data + srq->sended_len);
+		sqe->len = srq->send_len - srq->sended_len;
+		sqe->msg_flags = MSG_NOSIGNAL;
+		sqe->user_data = TSNET_URING_DATA(TSNET_URING_SEND, client_fd);
+
+		srq->inflight++;
+		conn->inflight++;
+	}
+	else if ( srq->send_type == TSNET_SEND_FILE ) {
+		size_t len = srq->pipe_len;
+
+		if ( len == 0 ) { // pipe is empty, fill it and drain it with linked requests
+			len = srq->send_len - srq->piped_len;
+			if ( len > TSNET_URING_SPLICE_CHUNK ) len = TSNET_URING_SPLICE_CHUNK;
+
+			if ( !(sqe = tsnet_uring_get_sqe(tsnet->uring)) ) return -1;
+
+			sqe->opcode = IORING_OP_SPLICE;
+			sqe->fd = srq->pipe_fd[1];
+			sqe->off = (uint64_t)-1;
+			sqe->splice_fd_in = srq->sendfile_fd;
+			sqe->splice_off_in = srq->piped_len;
+			sqe->len = len;
+			sqe->flags = IOSQE_IO_LINK;
+			sqe->user_data = TSNET_URING_DATA(TSNET_URING_SPLICE_IN, client_fd);
+
+			srq->inflight++;
+			conn->inflight++;
+		}
+
+		if ( !(sqe = tsnet_uring_get_sqe(tsnet->uring)) ) return -1;
+
+		sqe->opcode = IORING_OP_SPLICE;
+		sqe->fd = client_fd;
+		sqe->off = (uint64_t)-1;
+		sqe->splice_fd_in = srq->pipe_fd[0];
+		sqe->splice_off_in = (uint64_t)-1;
+		sqe->len = len;
+		sqe->user_data = TSNET_URING_DATA(TSNET_URING_SPLICE_OUT, client_fd);
 
-static void send_request_erase_free(void *data)
+		srq->inflight++;
+		conn->inflight++;
+	}
+	else { // it never happens, but i put in the code just in case 
+		TSNET_SET_ERROR("invalid send type (type: %d)", srq->send_type);
+		return -1;
+	}
+
+	conn->sending = 1;
+
+	return 0;
+}
+
+static void uring_release_client(TSNET *tsnet, struct tsnet_conn *conn)
+{
+	socket_t client_fd = conn->client.fd;
+
+	release_conn(tsnet, conn);
+
+	safe_close(client_fd);
+}
+
+static int uring_close_client(TSNET *tsnet, struct tsnet_conn *conn)
 {
+	socket_t client_fd = conn->client.fd;
+	struct io_uring_sqe *sqe;
+
+	if ( conn->closing ) return 0;
+
+	conn->closing = 1;
+
+	if ( tsnet->cb_vec[TSNET_EVENT_CLOSE] ) tsnet->cb_vec[TSNET_EVENT_CLOSE](tsnet, client_fd, NULL, 0);
+
+	if ( conn->inflight == 0 ) {
+		uring_release_client(tsnet, conn);
+		return 0;
+	}
+
+	// the kernel still uses fd and send buffers, release them when the last request completes
+	if ( !(sqe = tsnet_uring_get_sqe(tsnet->uring)) ) return -1;
+
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = client_fd;
+	sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+	sqe->user_data = TSNET_URING_DATA(TSNET_URING_CANCEL, client_fd);
+
+	(void)shutdown(client_fd, SHUT_RDWR);
+
+	return 0;
+}
+
+static int uring_send_done(TSNET *tsnet, struct tsnet_conn *conn, int op, int res)
+{
+	socket_t client_fd = conn->client.fd;
 	struct tsnet_send_request *srq;
 
-	if ( data ) {
-		srq = data;
-		if ( srq->send_type == TSNET_SEND_MEMORY ) {
-			safe_free(srq->send_data);
+	if ( !(srq = conn->send_head) ) {
+		TSNET_SET_ERROR("PANIC: send completion but can't find file descriptor");
+		return -1;
+	}
+
+	srq->inflight--;
+
+	if ( res < 0 && res != -ECANCELED ) {
+		TSNET_SET_ERROR("%s is failed: (errmsg: %s, errno: %d, srq->fd: %d, srq->send_len: %lu, srq->sended_len: %lu)", op == TSNET_URING_SEND ? "send()" : "splice()", strerror(-res), -res, srq->fd, srq->send_len, srq->sended_len);
+		return uring_close_client(tsnet, conn);
+	}
+
+	if ( op == TSNET_URING_SEND ) {
+		srq->sended_len += res;
+		conn->last_write = tsnet->now;
+
+		if ( account_sent(tsnet, conn, res) < 0 ) return -1;
+	}
+	else if ( op == TSNET_URING_SPLICE_IN ) {
+		if ( res == 0 ) { // the file is shrunk after tsnet_sendfile()
+			TSNET_SET_ERROR("splice() is failed: (errmsg: unexpected end of file, srq->fd: %d, srq->send_len: %lu, srq->piped_len: %lu)", srq->fd, srq->send_len, srq->piped_len);
+			return uring_close_client(tsnet, conn);
+		}
+		srq->piped_len += res;
+		srq->pipe_len += res;
+	}
+	else if ( op == TSNET_URING_SPLICE_OUT && res > 0 ) {
+		srq->pipe_len -= res;
+		srq->sended_len += res;
+		conn->last_write = tsnet->now;
+	}
+
+	if ( srq->inflight ) return 0; // linked splice is not finished yet
+
+	conn->sending = 0;
+
+	if ( srq->send_len == srq->sended_len ) { // sending is completed
+		send_queue_pop(tsnet, conn);
+
+		if ( tsnet->cb_vec[TSNET_EVENT_SEND_COMPLETE] ) tsnet->cb_vec[TSNET_EVENT_SEND_COMPLETE](tsnet, client_fd, NULL, 0);
+	}
+
+	// the callback may have started the next send already
+	if ( !conn->sending && !conn->closing ) return uring_submit_send(tsnet, conn);
+
+	return 0;
+}
+
+static int uring_handle_cqe(TSNET *tsnet, uint64_t user_data, int res, unsigned flags)
+{
+	struct tsnet_uring *ring = tsnet->uring;
+	struct tsnet_conn *conn;
+	int op = TSNET_URING_DATA_OP(user_data);
+	socket_t fd = TSNET_URING_DATA_FD(user_data);
+
+	switch (op) {
+		case TSNET_URING_ACCEPT:
+			if ( res >= 0 ) {
+				struct tsnet_client client;
+				socket_t client_fd = res;
+
+				if ( get_client_info(client_fd, &client) < 0 ) { // peer is already gone
+					close(client_fd);
+				}
+				else {
+					if ( !(conn = add_conn(tsnet, &client)) ) return -1;
+					if ( uring_submit_recv(tsnet, conn) < 0 ) return -1;
+
+					if ( tsnet->cb_vec[TSNET_EVENT_ACCEPT] ) tsnet->cb_vec[TSNET_EVENT_ACCEPT](tsnet, client_fd, NULL, 0);
+				}
+			}
+
+			if ( !(flags & IORING_CQE_F_MORE) ) return uring_submit_accept(tsnet);
+			break;
+		case TSNET_URING_RECV:
+			if ( !(conn = get_conn(tsnet, fd)) ) return -1;
+
+			if ( !(flags & IORING_CQE_F_MORE) ) {
+				conn->recv_armed = 0;
+				conn->inflight--;
+			}
+
+			if ( conn->closing ) {
+				if ( flags & IORING_CQE_F_BUFFER ) tsnet_uring_recycle_buffer(ring, flags >> IORING_CQE_BUFFER_SHIFT);
+				if ( conn->inflight == 0 ) uring_release_client(tsnet, conn);
+				break;
+			}
+
+			if ( res > 0 ) {
+				unsigned bid = flags >> IORING_CQE_BUFFER_SHIFT;
+
+				conn->last_read = tsnet->now;
+
+				if ( tsnet->input_limit ) { // provided buffers go back to the ring at once, the input buffer keeps a copy
+					if ( conn->input.end - conn->input.start >= tsnet->input_limit ) {
+						tsnet_uring_recycle_buffer(ring, bid);
+						return uring_close_client(tsnet, conn);
+					}
+
+					if ( tsnet_input_reserve(&tsnet->slab, &conn->input, res) < 0 ) return -1;
+
+					memcpy(conn->input.buf + conn->input.end, tsnet_uring_buffer(ring, bid), res);
+					conn->input.end += res;
+					tsnet_uring_recycle_buffer(ring, bid);
+
+					if ( deliver_input(tsnet, conn) < 0 ) return uring_close_client(tsnet, conn);
+				}
+				else {
+					if ( tsnet->cb_vec[TSNET_EVENT_RECV] ) tsnet->cb_vec[TSNET_EVENT_RECV](tsnet, fd, tsnet_uring_buffer(ring, bid), res);
+					tsnet_uring_recycle_buffer(ring, bid);
+				}
+			}
+			else if ( res != -ENOBUFS && res != -ECANCELED /* paused */ ) { // peer closed or error
+				if ( flags & IORING_CQE_F_BUFFER ) tsnet_uring_recycle_buffer(ring, flags >> IORING_CQE_BUFFER_SHIFT);
+				return uring_close_client(tsnet, conn);
+			}
+
+			if ( !conn->recv_armed && !conn->closing && !conn->paused ) return uring_submit_recv(tsnet, conn);
+			break;
+		case TSNET_URING_SEND:
+		case TSNET_URING_SPLICE_IN:
+		case TSNET_URING_SPLICE_OUT:
+			if ( !(conn = get_conn(tsnet, fd)) ) return -1;
+
+			conn->inflight--;
+
+			if ( conn->closing ) {
+				if ( conn->inflight == 0 ) uring_release_client(tsnet, conn);
+				break;
+			}
+
+			return uring_send_done(tsnet, conn, op, res);
+		case TSNET_URING_WAKEUP:
+			if ( run_posts(tsnet) < 0 ) return -1;
+			return uring_submit_wakeup(tsnet);
+		case TSNET_URING_CANCEL:
+			break;
+		default: // it never happens, but i put in the code just in case 
+			TSNET_SET_ERROR("invalid io_uring completion (op: %d, fd: %d)", op, fd);
+			return -1;
+	}
+
+	return 0;
+}
+
+static void conn_timer_cb(TSNET *tsnet, void *arg)
+{
+	int kind;
+	uint64_t deadline;
+	socket_t client_fd = (socket_t)(intptr_t)arg;
+	struct tsnet_conn *conn;
+
+	if ( !(conn = find_conn(tsnet, client_fd)) ) return;
+
+	conn->timer = NULL;
+
+	if ( conn->closing || !(deadline = conn_deadline(conn, &kind)) ) return;
+
+	// activity moved the deadline after the timer was armed
+	if ( deadline > tsnet->timers.now ) {
+		(void)arm_conn_timer(tsnet, conn);
+		return;
+	}
+
+	if ( tsnet->cb_vec[TSNET_EVENT_TIMEOUT] ) tsnet->cb_vec[TSNET_EVENT_TIMEOUT](tsnet, client_fd, NULL, kind);
+
+	if ( tsnet->type == TSNET_IO_URING ) (void)uring_close_client(tsnet, conn);
+	else (void)close_client(tsnet, client_fd);
+}
+
+static int uring_loop(TSNET *tsnet)
+{
+	struct io_uring_cqe *cqe;
+
+	if ( uring_submit_accept(tsnet) < 0 ) return -1;
+	if ( uring_submit_wakeup(tsnet) < 0 ) return -1;
+
+	while ( !__atomic_load_n(&tsnet->stop, __ATOMIC_ACQUIRE) ) {
+		tsnet_timer_advance(tsnet, &tsnet->timers, tsnet->now);
+
+		if ( tsnet->complete_list.count ) fire_send_complete(tsnet);
+		if ( tsnet->paused_list.count && tsnet->queued <= tsnet->total_low && resume_paused(tsnet) < 0 ) return -1;
+
+		// one system call submits everything queued by the callbacks and waits for completions (or the next timer)
+		if ( tsnet_uring_submit_and_wait(tsnet->uring, 1, tsnet_timer_timeout(&tsnet->timers, tsnet->now)) < 0 ) return -1;
+
+		tsnet->now = tsnet_timer_clock();
+
+		while ( (cqe = tsnet_uring_peek_cqe(tsnet->uring)) ) {
+			uint64_t user_data = cqe->user_data;
+			int res = cqe->res;
+			unsigned flags = cqe->flags;
+
+			tsnet_uring_cqe_seen(tsnet->uring);
+
+			if ( uring_handle_cqe(tsnet, user_data, res, flags) < 0 ) return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int insert_send_event(TSNET *tsnet, struct tsnet_conn *conn, struct tsnet_send_request *srq)
+{
+	struct tsnet_send_request *node;
+	char was_empty = conn->send_head == NULL;
+
+	if ( !(node = tsnet_slab_alloc(&tsnet->slab, sizeof(struct tsnet_send_request))) ) goto out;
+
+	if ( tsnet->type == TSNET_IO_URING ) {
+		if ( conn->closing ) {
+			TSNET_SET_ERROR("connection is closed: (fd: %d)", srq->fd);
+			goto out;
+		}
+	}
+	else if ( tsnet->edge_trigger ) { // fd is already registered for EPOLLOUT, no epoll_ctl() is needed
+		if ( was_empty && fd_list_push(&tsnet->flush_list, srq->fd) < 0 ) goto out;
+	}
+	else if ( update_events(tsnet, conn, read_events(conn) | EPOLLOUT) < 0 ) goto out;
+
+	memcpy(node, srq, sizeof(struct tsnet_send_request));
+	node->next = NULL;
+
+	if ( conn->send_tail ) conn->send_tail->next = node;
+	else conn->send_head = node;
+	conn->send_tail = node;
+
+	if ( was_empty && conn->write_timeout ) { // the write deadline starts now, it can be earlier than the armed one
+		conn->last_write = tsnet->now;
+		(void)arm_conn_timer(tsnet, conn);
+	}
+
+	if ( tsnet->type == TSNET_IO_URING && !conn->sending && uring_submit_send(tsnet, conn) < 0 ) {
+		conn->send_head = conn->send_tail = NULL; // nothing was sending, so the queue has only this request
+		tsnet_slab_free(&tsnet->slab, node, sizeof(struct tsnet_send_request));
+		return -1;
+	}
+	
+	return 0;
+
+out:
+	tsnet_slab_free(&tsnet->slab, node, sizeof(struct tsnet_send_request));
+
+	return -1;
+}
+
+TSNET * tsnet_create(int type, int backlog, int max_client)
+{
+	TSNET *tsnet = NULL;
+
+	switch (type) {
+		case TSNET_EPOLL:
+		case TSNET_IO_URING:
+			break;
+		default:
+			TSNET_SET_ERROR("invalid argument: (type = %d)", type);
+			goto out;
+	}
+
+	if ( !(tsnet = calloc(1, sizeof(TSNET))) ) {
+		TSNET_SET_ERROR("calloc() is failed: (errmsg: %s, errno: %d, size: %d)", strerror(errno), errno, sizeof(TSNET));
+		goto out;
+	}
+
+	tsnet->fd = -1;
+	tsnet->epfd = -1;
+	tsnet->type = type;
+	tsnet->io_workers = type == TSNET_EPOLL ? TSNET_IO_WORKERS : 0; // io_uring splices files in the ring, the kernel punts cold reads to its own workers
+	if ( tsnet_post_init(&tsnet->posts) < 0 ) goto out;
+	tsnet->now = tsnet_timer_clock();
+	tsnet_timer_init(&tsnet->timers, tsnet->now);
+	if ( tsnet_slab_init(&tsnet->slab, 0) < 0 ) goto out;
+	if ( backlog <= 0 ) tsnet->backlog = TSNET_DEFAULT_BACKLOG;
+	else tsnet->backlog = backlog;
+	if ( max_client <= 0 ) tsnet->max_client = TSNET_DEFAULT_MAX_CLIENT;
+	else tsnet->max_client = max_client;
+
+	signal(SIGPIPE, SIG_IGN);
+
+	return tsnet;
+
+out:
+	tsnet_delete(tsnet);
+
+	return NULL;
+}
+
+void tsnet_set_user_data(TSNET *tsnet, void *user_data)
+{
+	if ( tsnet && user_data ) tsnet->user_data = user_data;
+}
+
+void tsnet_set_conn_data_free(TSNET *tsnet, tsnet_conn_data_free_t conn_data_free)
+{
+	if ( tsnet && conn_data_free ) tsnet->conn_data_free = conn_data_free;
+}
+
+int tsnet_set_edge_trigger(TSNET *tsnet, char enable)
+{
+	if ( !tsnet || tsnet->type != TSNET_EPOLL ) {
+		TSNET_SET_ERROR("invalid argument: (tsnet = %s, type = %d)", CKNUL(tsnet), tsnet ? tsnet->type : -1);
+		return -1;
+	}
+
+	tsnet->edge_trigger = enable ? 1 : 0;
+
+	return 0;
+}
+
+int tsnet_set_zerocopy(TSNET *tsnet, size_t threshold)
+{
+	if ( !tsnet || tsnet->type != TSNET_EPOLL ) {
+		TSNET_SET_ERROR("invalid argument: (tsnet = %s, type = %d)", CKNUL(tsnet), tsnet ? tsnet->type : -1);
+		return -1;
+	}
+
+	tsnet->zerocopy_threshold = threshold;
+
+	return 0;
+}
+
+/* frames are assembled in the input buffer, it must hold the largest one (whichever setter runs last) */
+static size_t framing_input_limit(const struct tsnet_framing *framing, size_t limit)
+{
+	if ( framing->type != TSNET_FRAME_NONE && limit < framing->size + TSNET_FRAME_MAX_HEADER ) return framing->size + TSNET_FRAME_MAX_HEADER;
+
+	return limit;
+}
+
+int tsnet_set_recv_buffer(TSNET *tsnet, size_t limit)
+{
+	if ( !tsnet ) {
+		TSNET_SET_ERROR("invalid argument: (tsnet = null)");
+		return -1;
+	}
+
+	tsnet->input_limit = framing_input_limit(&tsnet->framing, limit);
+
+	return 0;
+}
+
+int tsnet_set_framing(TSNET *tsnet, int type, size_t size, uint8_t delimiter)
+{
+	if ( !tsnet || type < TSNET_FRAME_NONE || type > TSNET_FRAME_FIXED || (type != TSNET_FRAME_NONE && size == 0) ) {
+		TSNET_SET_ERROR("invalid argument: (tsnet = %s, type = %d, size = %lu)", CKNUL(tsnet), type, size);
+		return -1;
+	}
+
+	tsnet->framing.type = type;
+	tsnet->framing.size = size;
+	tsnet->framing.delimiter = delimiter;
+
+	tsnet->input_limit = framing_input_limit(&tsnet->framing, tsnet->input_limit);
+
+	return 0;
+}
+
+int tsnet_set_timeouts(TSNET *tsnet, uint64_t idle_ms, uint64_t read_ms, uint64_t write_ms)
+{
+	if ( !tsnet ) {
+		TSNET_SET_ERROR("invalid argument: (tsnet = null)");
+		return -1;
+	}
+
+	tsnet->idle_timeout = idle_ms;
+	tsnet->read_timeout = read_ms;
+	tsnet->write_timeout = write_ms;
+
+	return 0;
+}
+
+int tsnet_set_send_watermarks(TSNET *tsnet, size_t low, size_t high)
+{
+	if ( !tsnet || (high && low >= high) ) {
+		TSNET_SET_ERROR("invalid argument: (tsnet = %s, low = %lu, high = %lu)", CKNUL(tsnet), low, high);
+		return -1;
+	}
+
+	tsnet->send_low = low;
+	tsnet->send_high = high;
+
+	return 0;
+}
+
+int tsnet_set_total_send_watermarks(TSNET *tsnet, size_t low, size_t high)
+{
+	if ( !tsnet || (high && low >= high) ) {
+		TSNET_SET_ERROR("invalid argument: (tsnet = %s, low = %lu, high = %lu)", CKNUL(tsnet), low, high);
+		return -1;
+	}
+
+	tsnet->total_low = low;
+	tsnet->total_high = high;
+
+	return 0;
+}
+
+int tsnet_set_huge_pages(TSNET *tsnet, char enable)
+{
+	if ( !tsnet ) {
+		TSNET_SET_ERROR("invalid argument: (tsnet = %s)", CKNUL(tsnet));
+		return -1;
+	}
+
+	// slabs are remapped, so nothing may be allocated yet
+	return tsnet_slab_init(&tsnet->slab, enable);
+}
+
+void tsnet_delete(TSNET *tsnet)
+{
+	struct tsnet_post *post;
+
+	if ( tsnet ) {
+		// workers post completions to the loops: stopped before any loop goes, works never run are posted to their loops too
+		if ( tsnet->pool && tsnet->pool->owner == tsnet ) tsnet_pool_stop(tsnet->pool);
+		if ( tsnet->io_pool && tsnet->io_pool->owner == tsnet ) tsnet_pool_stop(tsnet->io_pool);
+		if ( tsnet->loops ) {
+			for ( int i = 1; i < tsnet->loop_count; i++ ) {
+				if ( !tsnet->loops[i] ) continue;
+
+				// shared with loop 0, deleted below
+				tsnet->loops[i]->pool = NULL;
+				tsnet_delete(tsnet->loops[i]);
+			}
+			safe_free(tsnet->loops);
+		}
+		safe_close(tsnet->fd);
+		safe_close(tsnet->epfd);
+		safe_free(tsnet->flush_list.fds);
+		safe_free(tsnet->read_list.fds);
+		safe_free(tsnet->paused_list.fds);
+		safe_free(tsnet->complete_list.fds);
+		if ( tsnet->uring ) {
+			tsnet_uring_exit(tsnet->uring);
+			safe_free(tsnet->uring);
 		}
-		else if ( srq->send_type == TSNET_SEND_FILE ) {
-			safe_close(srq->sendfile_fd);
+		// file reads still posted belong to these requests, so the connections go first
+		for ( size_t i = 0; i < tsnet->conns_size; i++ ) {
+			abort_zerocopy(&tsnet->conns[i]);
+			release_conn(tsnet, &tsnet->conns[i]);
 		}
+		// a done callback below can't queue work any more (tsnet_work() fails)
+		if ( tsnet->pool && tsnet->pool->owner == tsnet ) tsnet_pool_delete(tsnet->pool);
+		if ( tsnet->io_pool && tsnet->io_pool->owner == tsnet ) tsnet_pool_delete(tsnet->io_pool);
+		tsnet->pool = tsnet->io_pool = NULL;
+		// every post runs once, so its arg is freed by its callback (sends to the released connections fail)
+		while ( tsnet->posts.head && (post = tsnet_post_pop(&tsnet->posts)) ) {
+			if ( post->fn ) post->fn(tsnet, post->arg);
+			free(post);
+		}
+		safe_free(tsnet->conns);
+		tsnet_post_clear(&tsnet->posts);
+		tsnet_timer_clear(&tsnet->timers);
+		tsnet_slab_clear(&tsnet->slab);
+		free(tsnet);
 	}
 }
 
-static int close_client(TSNET *tsnet, int client_fd)
+int tsnet_bind(TSNET *tsnet, const char *ip, uint16_t port)
 {
-	if ( epoll_event_control(tsnet->epfd, EPOLL_CTL_DEL, client_fd, 0) < 0 ) {
-		TSNET_SET_ERROR("epoll_ctl(EPOLL_CTL_DEL) is failed: (errmsg: %s, errno: %d)", strerror(errno), errno);
-		goto out;
-	}
+	struct sockaddr_in saddr;
+	socklen_t reuse = 1;
 
-	if ( tsnet->cb_vec[TSNET_EVENT_CLOSE] ) tsnet->cb_vec[TSNET_EVENT_CLOSE](tsnet, client_fd, NULL, 0);
-	
-	(void)tsnet->send_request_client->erase(tsnet->send_request_client, &client_fd, sizeof(client_fd), 1);
-	if ( tsnet->connected_client->erase(tsnet->connected_client, &client_fd, sizeof(client_fd), 0) < 0 ) goto out;
+	memset(&saddr, 0x00, sizeof(saddr));
 	
-	safe_close(client_fd);
-						
-	return 0;
+	if ( !tsnet || !ip ) {
+		TSNET_SET_ERROR("invalid argument: (tsnet = %s, ip = %s)", CKNUL(tsnet), CKNUL(ip));
+		goto out;
+	}
 
-out:
-	return -1;
-}
+	snprintf(tsnet->ip, sizeof(tsnet->ip), "%s", ip);
+	tsnet->port = port;
 
-static int send_data_to_client(TSNET *tsnet, HashTableBucket *bucket, int client_fd /* same srq->fd */)
-{
-	ssize_t nsend;
-	char send_done = 0;
-	struct tsnet_send_request *srq;
+	if ( (tsnet->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0)) < 0 ) {
+		TSNET_SET_ERROR("socket() is failed: (errmsg: %s, errno: %d)", strerror(errno), errno);
+		goto out;
+	}
 
-	srq = bucket->value;
-	
-	if ( srq->send_type == TSNET_SEND_MEMORY ) {
-		do {
-			nsend = send(srq->fd, srq->send_data + srq->sended_len, srq->send_len - srq->sended_len, 0);
-			//printf("send nsend:     %ld\n", nsend);
-			if ( nsend > 0 ) srq->sended_len += nsend;
-		} while ( nsend > 0 );
+	if ( setsockopt(tsnet->fd, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse)) < 0 ) {
+		TSNET_SET_ERROR("setsockopt('SO_REUSEADDR') is failed: (errmsg: %s, errno: %d)", strerror(errno), errno);
+		goto out;
 	}
-	else if ( srq->send_type == TSNET_SEND_FILE ) {
-		do {
-			nsend = sendfile(client_fd, srq->sendfile_fd /* offset auto move */, NULL, srq->send_len - srq->sended_len);
-			//printf("sendfile nsend: %ld\n", nsend);
-			if ( nsend > 0 ) srq->sended_len += nsend;
-		} while ( nsend > 0 );
+
+#ifdef SO_REUSEPORT
+	reuse = 1;
+	if ( setsockopt(tsnet->fd, SOL_SOCKET, SO_REUSEPORT, (const char*)&reuse, sizeof(reuse)) < 0 ) {
+		TSNET_SET_ERROR("setsockopt('SO_REUSEPORT') is failed: (errmsg: %s, errno: %d)", strerror(errno), errno);
+		goto out;
 	}
-	else { // it never happens, but i put in the code just in case 
-		TSNET_SET_ERROR("invalid send type (type: %d)", srq->send_type);
+#endif
+
+	saddr.sin_family = AF_INET;
+	saddr.sin_port = htons(tsnet->port);
+	saddr.sin_addr.s_addr = inet_addr(tsnet->ip); 
+
+  if ( bind(tsnet->fd, (struct sockaddr *)&saddr, sizeof(saddr)) < 0 ) {
+		TSNET_SET_ERROR("bind(ip:%s, port:%u) is failed: (errmsg: %s, errno: %d)", tsnet->ip, tsnet->port, strerror(errno), errno);
 		goto out;
 	}
 	
-	if ( nsend < 0 ) {
-		if ( errno != EWOULDBLOCK ) {
-			if ( srq->send_type == TSNET_SEND_MEMORY ) {
-				TSNET_SET_ERROR("send() is failed: (nsend: %ld, errmsg: %s, errno: %d, srq->fd: %d, srq->send_len: %lu, srq->sended_len: %lu)", nsend, strerror(errno), errno, srq->fd, srq->send_len, srq->sended_len);
-			}
-			else {
-				TSNET_SET_ERROR("sendfile() is failed: (nsend: %ld, errmsg: %s, errno: %d, srq->fd: %d, srq->send_len: %lu, srq->sended_len: %lu)", nsend, strerror(errno), errno, srq->fd, srq->send_len, srq->sended_len);
-			}
+	if ( listen(tsnet->fd, tsnet->backlog) < 0 ) {
+		TSNET_SET_ERROR("listen(backlog:%u) is failed: (errmsg: %s, errno: %d)", tsnet->backlog, strerror(errno), errno);
+		goto out;
+	}
+
+	if ( tsnet->type == TSNET_IO_URING ) {
+		if ( !(tsnet->uring = calloc(1, sizeof(struct tsnet_uring))) ) {
+			TSNET_SET_ERROR("calloc() is failed: (errmsg: %s, errno: %d, size: %lu)", strerror(errno), errno, sizeof(struct tsnet_uring));
 			goto out;
 		}
+
+		if ( tsnet_uring_init(tsnet->uring, TSNET_URING_ENTRIES) < 0 ) goto out;
+		if ( tsnet_uring_setup_buffers(tsnet->uring, TSNET_URING_BUF_COUNT, TSNET_URING_BUF_SIZE) < 0 ) goto out;
 	}
-	
-	if ( srq->send_len == srq->sended_len ) send_done = 1; // sending is completed
-
-	if ( send_done ) {
-		if ( tsnet->send_request_client->erase(tsnet->send_request_client, &client_fd, sizeof(client_fd), 0) < 0 ) goto out;
-		
-		if ( tsnet->send_request_client->empty(tsnet->send_request_client, &client_fd, sizeof(client_fd)) ) {
-			if ( epoll_event_control(tsnet->epfd, EPOLL_CTL_MOD, client_fd, EPOLLIN) < 0 ) {
-				TSNET_SET_ERROR("epoll_ctl(EPOLL_CTL_MOD, EPOLLIN) is failed: (errmsg: %s, errno: %d)", strerror(errno), errno);
-				goto out;
-			}
+	else {
+		if ( (tsnet->epfd = epoll_create(1)) < 0 ) {
+			TSNET_SET_ERROR("epoll_create() is failed: (errmsg: %s, errno: %d)", strerror(errno), errno);
+			goto out;
 		}
 
-		if ( tsnet->cb_vec[TSNET_EVENT_SEND_COMPLETE] ) tsnet->cb_vec[TSNET_EVENT_SEND_COMPLETE](tsnet, client_fd, NULL, 0);
+		if ( epoll_event_control(tsnet->epfd, EPOLL_CTL_ADD, tsnet->fd, EPOLLIN) < 0 ) {
+			TSNET_SET_ERROR("epoll_ctl(EPOLL_CTL_ADD, EPOLLIN) is failed: (errmsg: %s, errno: %d)", strerror(errno), errno);
+			goto out;
+		}
+
+		if ( epoll_event_control(tsnet->epfd, EPOLL_CTL_ADD, tsnet->posts.event_fd, EPOLLIN) < 0 ) {
+			TSNET_SET_ERROR("epoll_ctl(EPOLL_CTL_ADD, EPOLLIN) is failed: (errmsg: %s, errno: %d, eventfd: %d)", strerror(errno), errno, tsnet->posts.event_fd);
+			goto out;
+		}
 	}
+	
+	tsnet->is_bind = 1;
 
 	return 0;
 
 out:
-	if ( srq->send_type == TSNET_SEND_MEMORY ) { 
-		safe_free(srq->send_data); 
+	return -1;
+}
+
+int tsnet_addListener(TSNET *tsnet, tsnet_event_t event, tsnet_cb_t cb)
+{
+	if ( !tsnet || !cb ) {
+		TSNET_SET_ERROR("invalid argument: (tsnet = %s, cb = %s)", CKNUL(tsnet), CKNUL(cb));
+		goto out;
 	}
-	else if ( srq->send_type == TSNET_SEND_FILE ) { 
-		safe_close(srq->sendfile_fd); 
+
+	switch (event) {
+		case TSNET_EVENT_ACCEPT:
+		case TSNET_EVENT_CLOSE:
+		case TSNET_EVENT_RECV:
+		case TSNET_EVENT_SEND_COMPLETE:
+		case TSNET_EVENT_FRAME:
+		case TSNET_EVENT_TIMEOUT:
+		case TSNET_EVENT_WRITABLE_LOW:
+			break;
+		default:
+			TSNET_SET_ERROR("invalid tsnet event: (event = %d)", event);
+			goto out;
 	}
 
-	(void)close_client(tsnet, client_fd);
+	tsnet->cb_vec[event] = cb;
+
+	return 0;
 
+out:
 	return -1;
 }
 
-static int insert_send_event(TSNET *tsnet, struct tsnet_send_request *srq)
+int tsnet_loop(TSNET *tsnet)
 {
-	if ( tsnet->send_request_client->insert(tsnet->send_request_client, &srq->fd, sizeof(srq->fd), srq, sizeof(struct tsnet_send_request)) ) goto out;
+	uint8_t *recv_buffer = NULL;
+
+	if ( !tsnet ) {
+		TSNET_SET_ERROR("invalid argument: (tsnet = null)");
+		return -1;
+	}
+
+	if ( !tsnet->is_bind) {
+		TSNET_SET_ERROR("tsnet is not ready: (first call tsnet_setup())");
+		return -1;
+	}
+
+	if ( tsnet->type == TSNET_IO_URING ) return uring_loop(tsnet);
 	
-	if ( epoll_event_control(tsnet->epfd, EPOLL_CTL_MOD, srq->fd, EPOLLIN | EPOLLOUT) < 0 ) {
-		TSNET_SET_ERROR("epoll_ctl(EPOLL_CTL_MOD, EPOLLIN | EPOLLOUT) is failed: (errmsg: %s, errno: %d)", strerror(errno), errno);
-		(void)tsnet->send_request_client->erase(tsnet->send_request_client, &srq->fd, sizeof(srq->fd), 1);
-		goto out;
+	if ( !(recv_buffer = malloc(TSNET_MAX_RECV_BYTES)) ) {
+		TSNET_SET_ERROR("malloc() is failed: (size: %d, errmsg: %s, errno: %d)", TSNET_MAX_RECV_BYTES, strerror(errno), errno);
+		return -1;
 	}
 	
+	struct epoll_event events[tsnet->max_client]; // I don't know why valgrind warns when doing dynamic allocation.
+
+	while ( !__atomic_load_n(&tsnet->stop, __ATOMIC_ACQUIRE) ) {
+		tsnet_timer_advance(tsnet, &tsnet->timers, tsnet->now);
+
+		if ( tsnet->complete_list.count ) fire_send_complete(tsnet);
+		if ( tsnet->flush_list.count && flush_pending_sends(tsnet) < 0 ) goto out;
+		if ( tsnet->read_list.count && resume_reads(tsnet, recv_buffer) < 0 ) goto out;
+		if ( tsnet->paused_list.count && tsnet->queued <= tsnet->total_low && resume_paused(tsnet) < 0 ) goto out;
+
+		// clients still have data to read, only poll for the others (otherwise sleep until the next timer)
+		int nfds = epoll_wait(tsnet->epfd, events, tsnet->max_client, tsnet->read_list.count ? 0 : tsnet_timer_timeout(&tsnet->timers, tsnet->now));
+
+		tsnet->now = tsnet_timer_clock(); // activity time of this turn
+
+		for ( int i = 0; i < nfds; i++ ) {
+			socket_t event_fd = events[i].data.fd;
+			unsigned int event = events[i].events;
+
+			if ( event_fd == tsnet->posts.event_fd ) { // tsnet_post(), tsnet_send_async()
+				if ( run_posts(tsnet) < 0 ) goto out;
+			}
+			else if ( (size_t)event_fd < tsnet->conns_size && tsnet->conns[event_fd].closing ) { // MSG_ZEROCOPY completions after close
+				if ( orphan_event(tsnet, &tsnet->conns[event_fd]) < 0 ) goto out;
+			}
+			else if ( event_fd == tsnet->fd /* server fd */) { // accept event
+				struct sockaddr_in caddr; 
+				socket_t client_fd;
+				socklen_t caddr_len = sizeof(caddr);
+
+				if ( (client_fd = accept4(tsnet->fd, (struct sockaddr *)&caddr, &caddr_len, SOCK_NONBLOCK)) < 0 ) continue;
+
+				struct tsnet_client client;
+				struct tsnet_conn *conn;
+				uint32_t client_events = tsnet->edge_trigger ? (EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET) : EPOLLIN;
+
+				if ( get_client_info(client_fd, &client) < 0 ) goto out;
+
+				if ( !(conn = add_conn(tsnet, &client)) ) goto out;
+
+				if ( epoll_event_control(tsnet->epfd, EPOLL_CTL_ADD, client_fd, client_events) < 0 ) {
+					TSNET_SET_ERROR("epoll_ctl(EPOLL_CTL_ADD, 0x%x) is failed: (errmsg: %s, errno: %d)", client_events, strerror(errno), errno);
+					goto out;
+				}
+
+				conn->events = client_events;
+
+				if ( tsnet->zerocopy_threshold ) { // old kernels do not have SO_ZEROCOPY, then sends are just copied
+					int one = 1;
+
+					conn->zerocopy = setsockopt(client_fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0;
+				}
+
+				if ( tsnet->cb_vec[TSNET_EVENT_ACCEPT] ) tsnet->cb_vec[TSNET_EVENT_ACCEPT](tsnet, client_fd, NULL, 0);
+			}
+			else if ( tsnet->edge_trigger ) {
+				int ret = 0;
+
+				// in/out edges can come together, both must be consumed or they are not reported again
+				if ( event & (EPOLLIN | EPOLLRDHUP) ) {
+					if ( (ret = recv_data_from_client(tsnet, event_fd, recv_buffer)) < 0 ) goto out;
+				}
+
+				if ( ret == 0 /* not closed */ && event & (EPOLLHUP | EPOLLERR) ) {
+					if ( (ret = error_event(tsnet, event_fd, event)) < 0 ) goto out;
+				}
+
+				if ( ret == 0 && event & EPOLLOUT ) {
+					if ( flush_send_queue(tsnet, event_fd) < 0 ) goto out;
+				}
+			}
+			else {
+				// recv event
+				if ( event & EPOLLIN ) {
+					if ( recv_data_from_client(tsnet, event_fd, recv_buffer) < 0 ) goto out;
+				}
+				// hang-up or error event
+				else if ( event & EPOLLHUP /* recv return zero(same case) */ || event & EPOLLERR ) {
+					if ( error_event(tsnet, event_fd, event) < 0 ) goto out;
+				}
+				// send event
+				else if ( event & EPOLLOUT ) {
+					struct tsnet_conn *conn;
+
+					if ( !(conn = get_conn(tsnet, event_fd)) || !conn->send_head ) {
+						TSNET_SET_ERROR("PANIC: EPOLLOUT event but can't find file descriptor");
+						goto out;
+					}
+
+					if ( send_data_to_client(tsnet, conn, event_fd) < 0 ) goto out;
+					//goto out; // memory leak test
+				}
+			}
+		}
+	}
+
+	safe_free(recv_buffer);
+
 	return 0;
 
 out:
+	safe_free(recv_buffer);
+
 	return -1;
 }
 
-static int get_client_info(socket_t client_fd, struct tsnet_client *client)
+/* any thread: the loop sees the flag once the eventfd wakes it */
+static void stop_loop(TSNET *loop)
 {
-	struct sockaddr_in caddr;
-	socklen_t caddr_len = sizeof(caddr);
+	__atomic_store_n(&loop->stop, 1, __ATOMIC_RELEASE);
+	(void)tsnet_post_wakeup(&loop->posts);
+}
 
-	if ( getpeername(client_fd, (struct sockaddr *)&caddr, &caddr_len) < 0 ) {
-		TSNET_SET_ERROR("getpeername() is failed: (errmsg: %s, errno: %d)\n", strerror(errno), errno);
-		goto out;
-	}
+static void * loop_thread_main(void *arg)
+{
+	TSNET *loop = arg;
 
-	if ( !inet_ntop(AF_INET, &caddr.sin_addr, client->ip, sizeof(client->ip)) ) {
-		TSNET_SET_ERROR("inet_ntop() is failed: (errmsg: %s, errno: %d)\n", strerror(errno), errno);
-		goto out;
+	// the error message is thread local: kept for tsnet_loop_threads(), and loop 0 is stopped to report it
+	if ( (loop->loop_ret = tsnet_loop(loop)) < 0 ) {
+		snprintf(loop->loop_error, sizeof(loop->loop_error), "%s", tsnet_get_last_error());
+		stop_loop(loop->parent);
 	}
 
-	client->fd = client_fd;
-	client->port = ntohs(caddr.sin_port);
+	// leave the SO_REUSEPORT group, so the kernel stops handing connections to a dead loop
+	safe_close(loop->fd);
 
-	return 0;
+	return NULL;
+}
 
-out:
-	return -1;
+/* loops leave at the end of their turn (callbacks and locks are never cut in the middle), then they are joined */
+static void stop_loops(TSNET *tsnet, int started)
+{
+	for ( int i = 1; i < started; i++ ) stop_loop(tsnet->loops[i]);
+	for ( int i = 1; i < started; i++ ) (void)pthread_join(tsnet->loops[i]->thread, NULL);
 }
 
-TSNET * tsnet_create(int type, int backlog, int max_client)
+int tsnet_loop_threads(TSNET *tsnet, int nthreads)
 {
-	TSNET *tsnet = NULL;
+	int ret, started = 1;
 
-	switch (type) {
-		case TSNET_EPOLL:
-			break;
-		default:
-			TSNET_SET_ERROR("invalid argument: (type = %d)", type);
-			goto out;
+	if ( !tsnet || nthreads <= 0 ) {
+		TSNET_SET_ERROR("invalid argument: (tsnet = %s, nthreads = %d)", CKNUL(tsnet), nthreads);
+		return -1;
 	}
 
-	if ( !(tsnet = calloc(1, sizeof(TSNET))) ) {
-		TSNET_SET_ERROR("calloc() is failed: (errmsg: %s, errno: %d, size: %d)", strerror(errno), errno, sizeof(TSNET));
-		goto out;
+	if ( !tsnet->is_bind ) {
+		TSNET_SET_ERROR("tsnet is not ready: (first call tsnet_bind())");
+		return -1;
 	}
 
-	tsnet->fd = -1;
-	if ( backlog <= 0 ) tsnet->backlog = TSNET_DEFAULT_BACKLOG;
-	else tsnet->backlog = backlog;
-	if ( max_client <= 0 ) tsnet->max_client = TSNET_DEFAULT_MAX_CLIENT;
-	else tsnet->max_client = max_client;
+	if ( tsnet->loops ) {
+		TSNET_SET_ERROR("event loop threads are already running");
+		return -1;
+	}
+
+	if ( !(tsnet->loops = calloc(nthreads, sizeof(TSNET *))) ) {
+		TSNET_SET_ERROR("calloc() is failed: (errmsg: %s, errno: %d, size: %lu)", strerror(errno), errno, nthreads * sizeof(TSNET *));
+		return -1;
+	}
 
-	if ( !(tsnet->connected_client = ht_create(0, 0, 0)) ) goto out;
-	if ( !(tsnet->send_request_client = ht_create(0, 0, 1)) ) goto out;
+	tsnet->loops[0] = tsnet;
+	tsnet->loop_count = nthreads;
+
+	// every loop owns its listener (SO_REUSEPORT), epfd and connection tables, so nothing is shared between threads
+	for ( int i = 1; i < nthreads; i++ ) {
+		TSNET *loop;
+
+		if ( !(loop = tsnet->loops[i] = tsnet_create(tsnet->type, tsnet->backlog, tsnet->max_client)) ) goto out;
+
+		memcpy(loop->cb_vec, tsnet->cb_vec, sizeof(loop->cb_vec));
+		loop->user_data = tsnet->user_data;
+		loop->edge_trigger = tsnet->edge_trigger;
+		loop->zerocopy_threshold = tsnet->zerocopy_threshold;
+		loop->input_limit = tsnet->input_limit;
+		loop->framing = tsnet->framing;
+		loop->idle_timeout = tsnet->idle_timeout;
+		loop->read_timeout = tsnet->read_timeout;
+		loop->write_timeout = tsnet->write_timeout;
+		loop->send_low = tsnet->send_low;
+		loop->send_high = tsnet->send_high;
+		loop->total_low = tsnet->total_low;
+		loop->total_high = tsnet->total_high;
+		loop->conn_data_free = tsnet->conn_data_free;
+		loop->pool = tsnet->pool;
+		loop->io_workers = tsnet->io_workers;
+		if ( tsnet_slab_init(&loop->slab, tsnet->slab.huge) < 0 ) goto out;
+		loop->loop_index = i;
+		loop->loop_count = nthreads;
+		loop->parent = tsnet;
+
+		if ( tsnet_bind(loop, tsnet->ip, tsnet->port) < 0 ) goto out;
+	}
 
-	ht_set_erase_free(tsnet->send_request_client, send_request_erase_free);
+	for ( ; started < nthreads; started++ ) {
+		if ( (ret = pthread_create(&tsnet->loops[started]->thread, NULL, loop_thread_main, tsnet->loops[started])) != 0 ) {
+			TSNET_SET_ERROR("pthread_create() is failed: (errmsg: %s, errno: %d)", strerror(ret), ret);
+			goto out;
+		}
+	}
 
-	signal(SIGPIPE, SIG_IGN);
+	ret = tsnet_loop(tsnet);
 
-	return tsnet;
+	stop_loops(tsnet, started);
+
+	// loop 0 returns 0 only when a failed loop stopped it
+	for ( int i = 1; i < started && ret == 0; i++ ) {
+		if ( tsnet->loops[i]->loop_ret < 0 ) {
+			TSNET_SET_ERROR("event loop %d is failed: %s", i, tsnet->loops[i]->loop_error);
+			ret = -1;
+		}
+	}
+
+	return ret;
 
 out:
-	tsnet_delete(tsnet);
+	stop_loops(tsnet, started);
 
-	return NULL;
+	return -1;
 }
 
-void tsnet_set_user_data(TSNET *tsnet, void *user_data)
+int tsnet_get_loop_index(TSNET *tsnet)
 {
-	if ( tsnet && user_data ) tsnet->user_data = user_data;
+	return tsnet ? tsnet->loop_index : -1;
+}
+
+struct tsnet_timer * tsnet_timer_add(TSNET *tsnet, uint64_t timeout_ms, tsnet_timer_cb_t cb, void *arg)
+{
+	if ( !tsnet || !cb ) {
+		TSNET_SET_ERROR("invalid argument: (tsnet = %s, cb = %s)", CKNUL(tsnet), CKNUL(cb));
+		return NULL;
+	}
+
+	return tsnet_timer_start(&tsnet->timers, tsnet_timer_clock() + timeout_ms, cb, arg);
+}
+
+int tsnet_timer_cancel(TSNET *tsnet, struct tsnet_timer *timer)
+{
+	if ( !tsnet || !timer ) {
+		TSNET_SET_ERROR("invalid argument: (tsnet = %s, timer = %s)", CKNUL(tsnet), CKNUL(timer));
+		return -1;
+	}
+
+	tsnet_timer_stop(&tsnet->timers, timer);
+
+	return 0;
 }
 
-void tsnet_delete(TSNET *tsnet)
+int tsnet_post(TSNET *tsnet, tsnet_post_cb_t fn, void *arg)
 {
-	if ( tsnet ) {
-		safe_close(tsnet->fd);
-		safe_close(tsnet->epfd);
-		ht_delete(tsnet->connected_client);
-		ht_delete(tsnet->send_request_client);
-		free(tsnet);
+	struct tsnet_post *post;
+
+	if ( !tsnet || !fn ) {
+		TSNET_SET_ERROR("invalid argument: (tsnet = %s, fn = %s)", CKNUL(tsnet), CKNUL(fn));
+		return -1;
+	}
+
+	// malloc(): the slab belongs to the loop thread
+	if ( !(post = calloc(1, sizeof(struct tsnet_post))) ) {
+		TSNET_SET_ERROR("calloc() is failed: (errmsg: %s, errno: %d, size: %lu)", strerror(errno), errno, sizeof(struct tsnet_post));
+		return -1;
 	}
+
+	post->fn = fn;
+	post->arg = arg;
+
+	tsnet_post_push(&tsnet->posts, post);
+
+	return tsnet_post_wakeup(&tsnet->posts);
 }
 
-int tsnet_bind(TSNET *tsnet, const char *ip, uint16_t port)
+int tsnet_send_async(TSNET *tsnet, socket_t client_fd, uint64_t conn_id, const void *data, size_t data_len)
 {
-	struct sockaddr_in saddr;
-	socklen_t reuse = 1;
+	struct tsnet_post *post;
 
-	memset(&saddr, 0x00, sizeof(saddr));
-	
-	if ( !tsnet || !ip ) {
-		TSNET_SET_ERROR("invalid argument: (tsnet = %s, ip = %s)", CKNUL(tsnet), CKNUL(ip));
-		goto out;
+	if ( !tsnet || client_fd < 0 || conn_id == 0 || !data || data_len == 0 ) {
+		TSNET_SET_ERROR("invalid argument: (tsnet = %s, client_fd = %d, conn_id = %lu, data = %s, data_len = %lu)", CKNUL(tsnet), client_fd, conn_id, CKNUL(data), data_len);
+		return -1;
 	}
 
-	snprintf(tsnet->ip, sizeof(tsnet->ip), "%s", ip);
-	tsnet->port = port;
-
-	if ( (tsnet->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0)) < 0 ) {
-		TSNET_SET_ERROR("socket() is failed: (errmsg: %s, errno: %d)", strerror(errno), errno);
-		goto out;
+	// the copy follows the node, one allocation
+	if ( !(post = malloc(sizeof(struct tsnet_post) + data_len)) ) {
+		TSNET_SET_ERROR("malloc() is failed: (errmsg: %s, errno: %d, size: %lu)", strerror(errno), errno, sizeof(struct tsnet_post) + data_len);
+		return -1;
 	}
 
-	if ( setsockopt(tsnet->fd, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse)) < 0 ) {
-		TSNET_SET_ERROR("setsockopt('SO_REUSEADDR') is failed: (errmsg: %s, errno: %d)", strerror(errno), errno);
-		goto out;
-	}
+	post->fn = NULL;
+	post->arg = NULL;
+	post->fd = client_fd;
+	post->conn_id = conn_id;
+	post->data = (uint8_t *)(post + 1);
+	post->data_len = data_len;
+	memcpy(post->data, data, data_len);
 
-#ifdef SO_REUSEPORT
-	reuse = 1;
-	if ( setsockopt(tsnet->fd, SOL_SOCKET, SO_REUSEPORT, (const char*)&reuse, sizeof(reuse)) < 0 ) {
-		TSNET_SET_ERROR("setsockopt('SO_REUSEPORT') is failed: (errmsg: %s, errno: %d)", strerror(errno), errno);
-		goto out;
-	}
-#endif
+	tsnet_post_push(&tsnet->posts, post);
 
-	saddr.sin_family = AF_INET;
-	saddr.sin_port = htons(tsnet->port);
-	saddr.sin_addr.s_addr = inet_addr(tsnet->ip); 
+	return tsnet_post_wakeup(&tsnet->posts);
+}
 
-  if ( bind(tsnet->fd, (struct sockaddr *)&saddr, sizeof(saddr)) < 0 ) {
-		TSNET_SET_ERROR("bind(ip:%s, port:%u) is failed: (errmsg: %s, errno: %d)", tsnet->ip, tsnet->port, strerror(errno), errno);
-		goto out;
-	}
-	
-	if ( listen(tsnet->fd, tsnet->backlog) < 0 ) {
-		TSNET_SET_ERROR("listen(backlog:%u) is failed: (errmsg: %s, errno: %d)", tsnet->backlog, strerror(errno), errno);
-		goto out;
+int tsnet_set_workers(TSNET *tsnet, int nworkers)
+{
+	if ( !tsnet ) {
+		TSNET_SET_ERROR("invalid argument: (tsnet = %s)", CKNUL(tsnet));
+		return -1;
 	}
 
-	if ( (tsnet->epfd = epoll_create(1)) < 0 ) {
-		TSNET_SET_ERROR("epoll_create() is failed: (errmsg: %s, errno: %d)", strerror(errno), errno);
-		goto out;
+	if ( tsnet->pool ) {
+		TSNET_SET_ERROR("the worker pool is already running");
+		return -1;
 	}
 
-	if ( epoll_event_control(tsnet->epfd, EPOLL_CTL_ADD, tsnet->fd, EPOLLIN) < 0 ) {
-		TSNET_SET_ERROR("epoll_ctl(EPOLL_CTL_ADD, EPOLLIN) is failed: (errmsg: %s, errno: %d)", strerror(errno), errno);
-		goto out;
+	if ( tsnet->loops ) {
+		TSNET_SET_ERROR("event loop threads are already running: (call it before tsnet_loop_threads())");
+		return -1;
 	}
-	
-	tsnet->is_bind = 1;
-
-	return 0;
 
-out:
-	return -1;
+	return (tsnet->pool = tsnet_pool_create(tsnet, nworkers)) ? 0 : -1;
 }
 
-int tsnet_addListener(TSNET *tsnet, tsnet_event_t event, tsnet_cb_t cb)
+int tsnet_set_io_workers(TSNET *tsnet, int nworkers)
 {
-	if ( !tsnet || !cb ) {
-		TSNET_SET_ERROR("invalid argument: (tsnet = %s, cb = %s)", CKNUL(tsnet), CKNUL(cb));
-		goto out;
+	if ( !tsnet || nworkers < 0 ) {
+		TSNET_SET_ERROR("invalid argument: (tsnet = %s, nworkers = %d)", CKNUL(tsnet), nworkers);
+		return -1;
 	}
 
-	switch (event) {
-		case TSNET_EVENT_ACCEPT:
-		case TSNET_EVENT_CLOSE:
-		case TSNET_EVENT_RECV:
-		case TSNET_EVENT_SEND_COMPLETE:
-			break;
-		default:
-			TSNET_SET_ERROR("invalid tsnet event: (event = %d)", event);
-			goto out;
+	if ( tsnet->io_pool || tsnet->loops ) {
+		TSNET_SET_ERROR("event loop is already running: (call it before tsnet_loop(), tsnet_loop_threads())");
+		return -1;
 	}
 
-	tsnet->cb_vec[event] = cb;
+	tsnet->io_workers = tsnet->type == TSNET_EPOLL ? nworkers : 0;
 
 	return 0;
-
-out:
-	return -1;
 }
 
-int tsnet_loop(TSNET *tsnet)
+int tsnet_work(TSNET *tsnet, tsnet_work_cb_t work, tsnet_post_cb_t done, void *arg)
 {
-	uint8_t *recv_buffer = NULL;
+	struct tsnet_work *node;
 
-	if ( !tsnet ) {
-		TSNET_SET_ERROR("invalid argument: (tsnet = null)");
+	if ( !tsnet || !work ) {
+		TSNET_SET_ERROR("invalid argument: (tsnet = %s, work = %s)", CKNUL(tsnet), CKNUL(work));
 		return -1;
 	}
 
-	if ( !tsnet->is_bind) {
-		TSNET_SET_ERROR("tsnet is not ready: (first call tsnet_setup())");
+	if ( !tsnet->pool ) {
+		TSNET_SET_ERROR("no worker pool: (first call tsnet_set_workers())");
 		return -1;
 	}
-	
-	if ( !(recv_buffer = malloc(TSNET_MAX_RECV_BYTES)) ) {
-		TSNET_SET_ERROR("malloc() is failed: (size: %d, errmsg: %s, errno: %d)", TSNET_MAX_RECV_BYTES, strerror(errno), errno);
+
+	// malloc(): a worker thread may free it (no done callback), otherwise the loop does as a post
+	if ( !(node = calloc(1, sizeof(struct tsnet_work))) ) {
+		TSNET_SET_ERROR("calloc() is failed: (errmsg: %s, errno: %d, size: %lu)", strerror(errno), errno, sizeof(struct tsnet_work));
 		return -1;
 	}
-	
-	struct epoll_event events[tsnet->max_client]; // I don't know why valgrind warns when doing dynamic allocation.
 
-	while (1) {
-		int nfds = epoll_wait(tsnet->epfd, events, tsnet->max_client, -1);
+	node->post.fn = done;
+	node->post.arg = arg;
+	node->work = work;
+	node->loop = tsnet;
 
-		for ( int i = 0; i < nfds; i++ ) {
-			socket_t event_fd = events[i].data.fd;
-			unsigned int event = events[i].events;
+	if ( tsnet_pool_submit(tsnet->pool, node) < 0 ) {
+		free(node);
+		return -1;
+	}
 
-			if ( event_fd == tsnet->fd /* server fd */) { // accept event
-				struct sockaddr_in caddr; 
-				socket_t client_fd;
-				socklen_t caddr_len = sizeof(caddr);
+	return 0;
+}
 
-				if ( (client_fd = accept4(tsnet->fd, (struct sockaddr *)&caddr, &caddr_len, SOCK_NONBLOCK)) < 0 ) continue;
+/* returns the bytes the socket took (0 when something is already queued) */
+static ssize_t send_direct(TSNET *tsnet, struct tsnet_conn *conn, const void *data, size_t data_len)
+{
+	ssize_t nsend;
 
-				struct tsnet_client client;
-				if ( get_client_info(client_fd, &client) < 0 ) goto out;
+	// something is queued, the data must wait behind it
+	if ( conn->send_head ) return 0;
 
-				if ( tsnet->connected_client->insert(tsnet->connected_client, &client_fd, sizeof(client_fd), &client, sizeof(client)) < 0 ) goto out;
+	if ( (nsend = send(conn->client.fd, data, data_len, MSG_DONTWAIT | MSG_NOSIGNAL)) < 0 ) {
+		if ( errno != EWOULDBLOCK && errno != EINTR ) {
+			TSNET_SET_ERROR("send() is failed: (nsend: %ld, errmsg: %s, errno: %d, fd: %d, data_len: %lu)", nsend, strerror(errno), errno, conn->client.fd, data_len);
+			return -1;
+		}
+		return 0;
+	}
 
-				if ( epoll_event_control(tsnet->epfd, EPOLL_CTL_ADD, client_fd, EPOLLIN) < 0 ) {
-					TSNET_SET_ERROR("epoll_ctl(EPOLL_CTL_ADD, EPOLLIN) is failed: (errmsg: %s, errno: %d)", strerror(errno), errno);
-					goto out;
-				}
+	if ( nsend > 0 ) conn->last_write = tsnet->now;
 
-				if ( tsnet->cb_vec[TSNET_EVENT_ACCEPT] ) tsnet->cb_vec[TSNET_EVENT_ACCEPT](tsnet, client_fd, NULL, 0);
-			}
-			else {
-				// recv event
-				if ( event & EPOLLIN ) {
-					memset(recv_buffer, 0x00, TSNET_MAX_RECV_BYTES);
+	if ( (size_t)nsend == data_len ) { // sending is completed
+		if ( tsnet->cb_vec[TSNET_EVENT_SEND_COMPLETE] && fd_list_push(&tsnet->complete_list, conn->client.fd) < 0 ) return -1;
+	}
 
-					ssize_t nrecv = recv(event_fd, recv_buffer, TSNET_MAX_RECV_BYTES, 0);
-					if ( nrecv <= 0 ) {
-						if ( close_client(tsnet, event_fd) < 0 ) goto out;
-					}
-					else {
-						if ( tsnet->cb_vec[TSNET_EVENT_RECV] ) tsnet->cb_vec[TSNET_EVENT_RECV](tsnet, event_fd, recv_buffer, nrecv);
-					}
-				}
-				// hang-up or error event
-				else if ( event & EPOLLHUP /* recv return zero(same case) */ || event & EPOLLERR ) {
-					if ( close_client(tsnet, event_fd) < 0 ) goto out;
-				}
-				// send event
-				else if ( event & EPOLLOUT ) {
-					HashTableBucket *bucket;
+	return nsend;
+}
 
-					if ( !(bucket = tsnet->send_request_client->find(tsnet->send_request_client, &event_fd, sizeof(event_fd))) ) {
-						TSNET_SET_ERROR("PANIC: EPOLLOUT event but can't find file descriptor");
-						goto out;
-					}
+static int queue_memory_request(TSNET *tsnet, struct tsnet_conn *conn, uint8_t *data, size_t data_len, size_t sended_len, tsnet_free_t free_fn, void *free_arg, char zerocopy)
+{
+	struct tsnet_send_request srq;
 
-					if ( send_data_to_client(tsnet, bucket, event_fd) < 0 ) goto out;
-					//goto out; // memory leak test
-				}
-			}
-		}
-	}
+	memset(&srq, 0x00, sizeof(srq));
 
-	safe_free(recv_buffer);
+	srq.fd = conn->client.fd;
+	srq.send_type = TSNET_SEND_MEMORY;
+	srq.send_data = data;
+	srq.send_len = data_len;
+	srq.sended_len = sended_len;
+	srq.free_fn = free_fn;
+	srq.free_arg = free_arg;
+	srq.zerocopy = zerocopy;
 
-	return 0;
+	if ( insert_send_event(tsnet, conn, &srq) < 0 ) return -1;
 
-out:
-	safe_free(recv_buffer);
+	account_queued(tsnet, conn, data_len - sended_len);
 
-	return -1;
+	return 0;
 }
 
 int tsnet_send(TSNET *tsnet, socket_t client_fd, const void *data, size_t data_len)
 {
-	struct tsnet_send_request srq;
-	
-	memset(&srq, 0x00, sizeof(srq));
+	ssize_t nsend;
+	struct tsnet_conn *conn;
+	uint8_t *send_data = NULL;
+	size_t copy_len = 0;
 
 	if ( !tsnet || client_fd < 0 || !data || data_len == 0 ) {
 		TSNET_SET_ERROR("invalid argument: (tsnet = %s, client_fd = %d, data = %s, data_len = %lu", CKNUL(tsnet), client_fd, CKNUL(data), data_len);
 		goto out;
 	}
 
-	if ( !(srq.send_data = malloc(data_len)) ) {
-		TSNET_SET_ERROR("malloc() is failed: (errmsg: %s, errno: %d, size: %d)", strerror(errno), errno, data_len);
+	if ( !(conn = get_conn(tsnet, client_fd)) ) goto out;
+
+	if ( (nsend = send_direct(tsnet, conn, data, data_len)) < 0 ) goto out;
+	if ( (size_t)nsend == data_len ) return 0;
+
+	// queue only the bytes the socket did not take (free_fn NULL: the copy is from the slab)
+	copy_len = data_len - nsend;
+	if ( !(send_data = tsnet_slab_alloc(&tsnet->slab, copy_len)) ) goto out;
+	
+	memcpy(send_data, (const uint8_t *)data + nsend, copy_len);
+
+	if ( queue_memory_request(tsnet, conn, send_data, copy_len, 0, NULL, NULL, 0) < 0 ) goto out;
+	
+	return 0;
+
+out:
+	if ( send_data ) tsnet_slab_free(&tsnet->slab, send_data, copy_len);
+
+	return -1;
+}
+
+int tsnet_send_owned(TSNET *tsnet, socket_t client_fd, void *buf, size_t buf_len, tsnet_free_t free_fn, void *arg)
+{
+	ssize_t nsend;
+	struct tsnet_conn *conn;
+
+	if ( !tsnet || client_fd < 0 || !buf || buf_len == 0 || !free_fn ) {
+		TSNET_SET_ERROR("invalid argument: (tsnet = %s, client_fd = %d, buf = %s, buf_len = %lu, free_fn = %s", CKNUL(tsnet), client_fd, CKNUL(buf), buf_len, CKNUL(free_fn));
 		goto out;
 	}
-	
-	memcpy(srq.send_data, data, data_len);
 
-	srq.fd = client_fd;
-	srq.send_type = TSNET_SEND_MEMORY;
-	srq.send_len = data_len;
-	srq.sended_len = 0;
+	if ( !(conn = get_conn(tsnet, client_fd)) ) goto out;
+
+	// large buffers are sent from the loop with MSG_ZEROCOPY, they are released on the kernel completion
+	if ( conn->zerocopy && buf_len >= tsnet->zerocopy_threshold ) {
+		if ( queue_memory_request(tsnet, conn, buf, buf_len, 0, free_fn, arg, 1) < 0 ) goto out;
+		return 0;
+	}
+
+	if ( (nsend = send_direct(tsnet, conn, buf, buf_len)) < 0 ) goto out;
+	if ( (size_t)nsend == buf_len ) {
+		free_fn(buf, arg);
+		return 0;
+	}
+
+	// no copy, the queue keeps buf and skips the bytes already sent
+	if ( queue_memory_request(tsnet, conn, buf, buf_len, nsend, free_fn, arg, 0) < 0 ) goto out;
 
-	if ( insert_send_event(tsnet, &srq) < 0 ) goto out;
-	
 	return 0;
 
 out:
-	safe_free(srq.send_data);
+	if ( buf && free_fn ) free_fn(buf, arg); // ownership is taken even on failure
 
 	return -1;
 }
@@ -417,15 +2243,19 @@ out:
 int tsnet_sendfile(TSNET *tsnet, socket_t client_fd, const char *file_path)
 {
 	struct stat st;
+	struct tsnet_conn *conn;
 	struct tsnet_send_request srq;
 	
 	memset(&srq, 0x00, sizeof(srq));
+	srq.sendfile_fd = srq.pipe_fd[0] = srq.pipe_fd[1] = -1;
 	
 	if ( !tsnet || client_fd < 0 || !file_path ) {
 		TSNET_SET_ERROR("invalid argument: (tsnet = %s, client_fd = %d, file_path = %s", CKNUL(tsnet), client_fd, CKNUL(file_path));
 		goto out;
 	}
 
+	if ( !(conn = get_conn(tsnet, client_fd)) ) goto out;
+
 	if ( (srq.sendfile_fd = open(file_path, O_RDONLY)) < 0 ) {
 		TSNET_SET_ERROR("open() is failed: (errmsg: %s, errno: %d, path: %s)\n", strerror(errno), errno, file_path);
 		goto out;
@@ -436,29 +2266,75 @@ int tsnet_sendfile(TSNET *tsnet, socket_t client_fd, const char *file_path)
 		goto out;
 	}
 
+	if ( tsnet->type == TSNET_IO_URING && pipe2(srq.pipe_fd, O_CLOEXEC) < 0 ) {
+		TSNET_SET_ERROR("pipe2() is failed: (errmsg: %s, errno: %d)", strerror(errno), errno);
+		goto out;
+	}
+
 	srq.fd = client_fd;
 	srq.send_type = TSNET_SEND_FILE;
 	srq.send_len = st.st_size;
 	srq.sended_len = 0;
 
-	if ( insert_send_event(tsnet, &srq) < 0 ) goto out;
+	if ( insert_send_event(tsnet, conn, &srq) < 0 ) goto out;
 	
 	return 0;
 
 out:
+	safe_close(srq.sendfile_fd);
+	safe_close(srq.pipe_fd[0]);
+	safe_close(srq.pipe_fd[1]);
+
 	return -1;
 }
 
-int tsnet_get_client_info(TSNET *tsnet, socket_t client_fd, struct tsnet_client *client)
+int tsnet_consume(TSNET *tsnet, socket_t client_fd, size_t n)
 {
-	HashTableBucket *bucket;
+	struct tsnet_conn *conn;
 
-	if ( !(bucket = tsnet->connected_client->find(tsnet->connected_client, &client_fd, sizeof(client_fd))) ) {
-		TSNET_SET_ERROR("can not found (connected_client: fd = %d)", client_fd);
-		goto out;
+	if ( !tsnet || client_fd < 0 ) {
+		TSNET_SET_ERROR("invalid argument: (tsnet = %s, client_fd = %d)", CKNUL(tsnet), client_fd);
+		return -1;
+	}
+
+	if ( !(conn = get_conn(tsnet, client_fd)) ) return -1;
+
+	if ( n > conn->input.end - conn->input.start ) {
+		TSNET_SET_ERROR("consume more than buffered: (fd: %d, n: %lu, buffered: %lu)", client_fd, n, conn->input.end - conn->input.start);
+		return -1;
 	}
 
-	memcpy(client, bucket->value, bucket->value_len);
+	// the buffer is released by the loop after the callback returns
+	conn->input.start += n;
+
+	return 0;
+}
+
+int tsnet_set_conn_timeouts(TSNET *tsnet, socket_t client_fd, uint64_t idle_ms, uint64_t read_ms, uint64_t write_ms)
+{
+	struct tsnet_conn *conn;
+
+	if ( !tsnet || client_fd < 0 ) {
+		TSNET_SET_ERROR("invalid argument: (tsnet = %s, client_fd = %d)", CKNUL(tsnet), client_fd);
+		return -1;
+	}
+
+	if ( !(conn = get_conn(tsnet, client_fd)) ) return -1;
+
+	conn->idle_timeout = idle_ms;
+	conn->read_timeout = read_ms;
+	conn->write_timeout = write_ms;
+
+	return arm_conn_timer(tsnet, conn);
+}
+
+int tsnet_get_client_info(TSNET *tsnet, socket_t client_fd, struct tsnet_client *client)
+{
+	struct tsnet_conn *conn;
+
+	if ( !(conn = get_conn(tsnet, client_fd)) ) goto out;
+
+	memcpy(client, &conn->client, sizeof(struct tsnet_client));
 
 	return 0;
 
@@ -466,6 +2342,79 @@ out:
 	return -1;
 }
 
+int tsnet_set_conn_data(TSNET *tsnet, socket_t client_fd, void *conn_data)
+{
+	struct tsnet_conn *conn;
+
+	if ( !tsnet ) {
+		TSNET_SET_ERROR("invalid argument: (tsnet = null)");
+		return -1;
+	}
+
+	if ( !(conn = get_conn(tsnet, client_fd)) ) return -1;
+
+	conn->user_data = conn_data;
+
+	return 0;
+}
+
+void * tsnet_get_conn_data(TSNET *tsnet, socket_t client_fd)
+{
+	struct tsnet_conn *conn;
+
+	if ( !tsnet || !(conn = find_conn(tsnet, client_fd)) ) return NULL;
+
+	return conn->user_data;
+}
+
+uint64_t tsnet_get_conn_id(TSNET *tsnet, socket_t client_fd)
+{
+	struct tsnet_conn *conn;
+
+	if ( !tsnet || !(conn = find_conn(tsnet, client_fd)) ) return 0;
+
+	return conn->id;
+}
+
+int tsnet_get_zerocopy_stats(TSNET *tsnet, socket_t client_fd, size_t *sends, size_t *copied)
+{
+	struct tsnet_conn *conn;
+
+	if ( !tsnet || client_fd < 0 ) {
+		TSNET_SET_ERROR("invalid argument: (tsnet = %s, client_fd = %d)", CKNUL(tsnet), client_fd);
+		return -1;
+	}
+
+	if ( !(conn = get_conn(tsnet, client_fd)) ) return -1;
+
+	if ( sends ) *sends = conn->zc_sends;
+	if ( copied ) *copied = conn->zc_copied;
+
+	return 0;
+}
+
+int tsnet_get_slab_stats(TSNET *tsnet, struct tsnet_slab_stats *stats)
+{
+	if ( !tsnet || !stats ) {
+		TSNET_SET_ERROR("invalid argument: (tsnet = %s, stats = %s)", CKNUL(tsnet), CKNUL(stats));
+		return -1;
+	}
+
+	tsnet_slab_stats(&tsnet->slab, stats);
+
+	return 0;
+}
+
+struct tsnet_slab * tsnet_get_slab(TSNET *tsnet)
+{
+	if ( !tsnet ) {
+		TSNET_SET_ERROR("invalid argument: (tsnet = null)");
+		return NULL;
+	}
+
+	return &tsnet->slab;
+}
+
 const char *tsnet_get_last_error()
 {
 	return tsnet_last_error;
@@ -9,6 +9,7 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <pthread.h>
 
 #include "hashtable.h"
 
@@ -17,10 +18,20 @@ typedef struct tsnet TSNET;
 typedef int socket_t;
 typedef int tsnet_event_t;
 typedef void(*tsnet_cb_t)(TSNET *tsnet, socket_t client_fd, uint8_t *data, ssize_t data_len);
+typedef void(*tsnet_conn_data_free_t)(void *conn_data);
+typedef void(*tsnet_free_t)(void *buf, void *arg);
+typedef void(*tsnet_timer_cb_t)(TSNET *tsnet, void *arg);
+typedef void(*tsnet_post_cb_t)(TSNET *tsnet, void *arg);
+typedef void(*tsnet_work_cb_t)(void *arg);
+
+#define TSNET_TIMER_LEVELS 4
+#define TSNET_TIMER_SLOTS 256
+#define TSNET_SLAB_CLASSES 36 /* 16 ~ 128 by 16, then 4 classes per power of two up to 16384 */
+#define TSNET_WORK_DEQUE 256 /* works a worker holds for itself (others steal from it), 2^n */
 
 enum tsnet_server_type {
 	TSNET_EPOLL,
-	//TSNET_IO_URING, /* not yet */
+	TSNET_IO_URING,
 };
 
 enum tsnet_event_type {
@@ -28,6 +39,9 @@ enum tsnet_event_type {
 	TSNET_EVENT_CLOSE,
 	TSNET_EVENT_RECV,
 	TSNET_EVENT_SEND_COMPLETE,
+	TSNET_EVENT_FRAME, /* tsnet_set_framing(): one whole frame (payload only) */
+	TSNET_EVENT_TIMEOUT, /* tsnet_set_timeouts(): data_len is enum tsnet_timeout_type, the client is closed after it */
+	TSNET_EVENT_WRITABLE_LOW, /* send queue drained below the low watermark, reading is resumed */
 	TSNET_EVENT_MAX
 };
 
@@ -36,18 +50,216 @@ enum tsnet_send_type {
 	TSNET_SEND_FILE
 };
 
+enum tsnet_frame_type {
+	TSNET_FRAME_NONE = 0,
+	TSNET_FRAME_U16, /* 2 byte length prefix (network byte order) */
+	TSNET_FRAME_U32, /* 4 byte length prefix (network byte order) */
+	TSNET_FRAME_VARINT, /* base 128 varint length prefix (protobuf style) */
+	TSNET_FRAME_DELIMITER, /* frames end with a delimiter byte (e.g. '\n') */
+	TSNET_FRAME_FIXED /* every frame has the same size */
+};
+
+enum tsnet_timeout_type {
+	TSNET_TIMEOUT_IDLE = 1, /* nothing was received or sent */
+	TSNET_TIMEOUT_READ, /* nothing was received */
+	TSNET_TIMEOUT_WRITE /* queued data made no progress */
+};
+
 struct tsnet_client {
 	socket_t fd;
 	char ip[16];
 	uint16_t port;
 };
 
+struct tsnet_fd_list {
+	socket_t *fds;
+	size_t count, size;
+};
+
 struct tsnet_send_request {
 	socket_t fd;
 	char send_type;
 	uint8_t *send_data;
 	size_t send_len, sended_len;
+	tsnet_free_t free_fn; // TSNET_SEND_MEMORY: releases send_data (NULL: tsnet_send() copy from the slab, send_len bytes)
+	void *free_arg;
 	int sendfile_fd;
+	size_t cached_len; // TSNET_EPOLL: bytes known to be in page cache (sendfile() does not block on disk up to here)
+	struct tsnet_file_read *file_read; // TSNET_EPOLL: the next window is being read by an I/O worker
+	int pipe_fd[2]; // TSNET_IO_URING: sendfile is spliced (sendfile_fd -> pipe -> fd)
+	size_t piped_len, pipe_len; // bytes moved into the pipe (total), bytes still left in the pipe
+	int inflight;
+	char zerocopy; // sent with MSG_ZEROCOPY, send_data is released after the kernel reports completion
+	uint32_t zc_first, zc_count, zc_refs; // notification ids used (zc_first ~ zc_first + zc_count - 1), not yet completed
+
+	struct tsnet_send_request *next; // per connection send queue (FIFO)
+};
+
+/* per connection input buffer: unconsumed bytes are buf[start] ~ buf[end - 1] */
+struct tsnet_input {
+	uint8_t *buf; // NULL while nothing is buffered
+	size_t size, start, end; // buf is size bytes from the slab of the event loop
+};
+
+struct tsnet_framing {
+	int type; // enum tsnet_frame_type
+	size_t size; // TSNET_FRAME_FIXED: frame size, others: max payload size
+	uint8_t delimiter;
+};
+
+struct tsnet_timer {
+	struct tsnet_timer *next, **pprev; // wheel slot list
+	uint64_t expire; // ms (CLOCK_MONOTONIC)
+	uint8_t level, slot;
+	tsnet_timer_cb_t cb;
+	void *arg;
+};
+
+/* hierarchical timer wheel of an event loop (tsnet_timer.c) */
+struct tsnet_timer_wheel {
+	uint64_t now; // last tick (ms) processed
+	size_t count; // armed timers
+	struct tsnet_timer *slots[TSNET_TIMER_LEVELS][TSNET_TIMER_SLOTS];
+	uint64_t bitmap[TSNET_TIMER_LEVELS][TSNET_TIMER_SLOTS / 64]; // non-empty slots
+	struct tsnet_timer *free_list;
+};
+
+/* header of a slab (tsnet_slab.c), objects of one size class follow it */
+struct tsnet_slab_page {
+	struct tsnet_slab_page *next, *prev; // slabs of the class with free objects
+	struct tsnet_slab_page *all_next, *all_prev; // every slab of the allocator
+	void *free_list; // freed objects, linked with their first bytes
+	uint8_t *bump; // objects from here to the end were never used
+	uint32_t used, total;
+	uint8_t cls;
+	char huge; // MAP_HUGETLB mapping
+};
+
+struct tsnet_slab_class {
+	size_t size; // object size
+	struct tsnet_slab_page *partial;
+	size_t slabs, used, capacity; // slabs, objects in use, objects the slabs hold
+};
+
+struct tsnet_slab {
+	char huge; // slabs are huge pages (MAP_HUGETLB, or madvise(MADV_HUGEPAGE) when none are reserved)
+	size_t slab_bytes;
+	struct tsnet_slab_class classes[TSNET_SLAB_CLASSES];
+	struct tsnet_slab_page *slabs;
+	size_t huge_slabs; // slabs mapped with MAP_HUGETLB
+	size_t large, large_bytes; // live allocations over TSNET_SLAB_MAX_SIZE (malloc())
+};
+
+/* tsnet_get_slab_stats(), ht_get_slab_stats() */
+struct tsnet_slab_stats {
+	size_t slab_bytes; // size of one slab
+	size_t slabs, huge_slabs; // mapped slabs (huge_slabs: MAP_HUGETLB)
+	size_t mapped, used; // bytes mapped for slabs, bytes of the objects in use
+	size_t large, large_bytes; // live allocations over the largest class
+	struct {
+		size_t size, slabs, used, capacity;
+	} classes[TSNET_SLAB_CLASSES];
+};
+
+/* a tsnet_post() call or a tsnet_send_async() copy, run by the event loop */
+struct tsnet_post {
+	struct tsnet_post *next;
+	tsnet_post_cb_t fn; // NULL: tsnet_send_async()
+	void *arg;
+	socket_t fd;
+	uint64_t conn_id; // tsnet_send_async(): dropped when fd is another connection by then
+	uint8_t *data; // tsnet_send_async(): copy of data_len bytes, allocated with the node
+	size_t data_len;
+};
+
+/* lock free multi producer, single consumer queue (intrusive, Vyukov), the event loop thread is the consumer */
+struct tsnet_post_queue {
+	struct tsnet_post *head; // last pushed, producers exchange it
+	uint8_t pad[64 - sizeof(struct tsnet_post *)]; // producers and the loop don't share a cache line
+	struct tsnet_post *tail; // next to run (event loop only)
+	struct tsnet_post stub;
+	int event_fd; // eventfd in the epoll set (TSNET_IO_URING: polled by the ring)
+	int wake; // event_fd is written and the loop has not run the queue since
+};
+
+/* tsnet_work(): runs on a worker, then the node itself is posted to its loop (post.fn: the done callback) */
+struct tsnet_work {
+	struct tsnet_post post; // first member, freed by the loop after done
+	tsnet_work_cb_t work;
+	TSNET *loop;
+};
+
+/* a pool thread with its work stealing deque (Chase-Lev): the owner pushes and takes at bottom, others steal at top */
+struct tsnet_worker {
+	int64_t top;
+	uint8_t pad_top[64 - sizeof(int64_t)];
+	int64_t bottom;
+	uint8_t pad_bottom[64 - sizeof(int64_t)];
+	struct tsnet_work *deque[TSNET_WORK_DEQUE];
+
+	struct tsnet_pool *pool;
+	pthread_t thread;
+	int index;
+	size_t works, steals; // works run, works stolen from other workers
+};
+
+/* tsnet_sendfile() (TSNET_EPOLL): a window not in page cache is read on the I/O pool, then the send resumes */
+struct tsnet_file_read {
+	struct tsnet_work work; // first member, freed by the loop after file_read_done()
+	int file_fd;
+	size_t offset, len;
+	socket_t fd;
+	struct tsnet_send_request *srq; // NULL: the request is freed meanwhile (file_fd is closed by the loop then)
+};
+
+/* tsnet_set_workers(): shared by every event loop of tsnet_loop_threads() */
+struct tsnet_pool {
+	pthread_mutex_t lock; // inject list, idle, stop
+	pthread_cond_t cond; // idle workers
+	struct tsnet_work *inject_head, *inject_tail; // from event loops (linked by post.next), workers move batches into their deques
+	size_t inject_count;
+	int idle;
+	char stop;
+
+	struct tsnet_worker *workers;
+	int count, started;
+	TSNET *owner; // deleted with it
+};
+
+/* connection table slot (index: fd) */
+struct tsnet_conn {
+	struct tsnet_client client;
+	struct tsnet_send_request *send_head, *send_tail;
+	uint32_t events; // TSNET_EPOLL: registered epoll events
+	char in_use;
+	uint64_t id; // tsnet_get_conn_id(): never reused by the event loop, a reused fd gets a new one
+	void *user_data; // tsnet_set_conn_data()
+	size_t recv_size; // TSNET_EPOLL: next recv() size, doubled when a read fills it, halved after two reads that fit in half
+	char recv_small; // consecutive reads that fit in half of recv_size
+	struct tsnet_input input; // tsnet_set_recv_buffer()
+	size_t frame_scan; // TSNET_FRAME_DELIMITER: input bytes already searched
+	int rcvlowat; // TSNET_EPOLL: SO_RCVLOWAT set for the pending frame (0: kernel default)
+
+	/* send watermarks (only memory requests are counted, a file request holds no memory) */
+	size_t queued; // bytes not sent yet
+	char paused; // TSNET_PAUSE_*: reading is stopped
+
+	/* timeouts (ms, 0: none), checked lazily: activity only updates last_read / last_write */
+	uint64_t idle_timeout, read_timeout, write_timeout;
+	uint64_t last_read, last_write; // last_write: last send progress, or when the queue became non-empty
+	struct tsnet_timer *timer;
+
+	/* TSNET_EPOLL: MSG_ZEROCOPY */
+	char zerocopy; // SO_ZEROCOPY is enabled on the socket
+	uint32_t zc_next_id; // notification id of the next MSG_ZEROCOPY send
+	size_t zc_sends, zc_copied; // MSG_ZEROCOPY sends, sends the kernel (or ENOBUFS) made copy anyway
+	struct tsnet_send_request *zc_head, *zc_tail; // sent requests waiting for completion (a closed connection waits for them, see closing)
+
+	/* TSNET_IO_URING */
+	int inflight; // submitted but not completed requests (a multishot recv counts once)
+	char recv_armed;
+	char sending;
+	char closing; // closed by tsnet, but waiting for inflight requests (TSNET_EPOLL: zc_head completions, not in_use) before close(fd)
 };
 
 typedef struct tsnet {
@@ -55,6 +267,7 @@ typedef struct tsnet {
 
 	socket_t fd;
 	int epfd;
+	struct tsnet_uring *uring; // TSNET_IO_URING
 
 	char ip[16];
 	uint16_t port;
@@ -62,24 +275,92 @@ typedef struct tsnet {
 	int max_client;
 
 	tsnet_cb_t cb_vec[TSNET_EVENT_MAX];
-	HashTable *send_request_client; // client that sent the send request 
-	HashTable *connected_client;
+	struct tsnet_conn *conns; // connected clients (index: fd)
+	size_t conns_size;
 
 	void *user_data;
+	tsnet_conn_data_free_t conn_data_free; // called with connection user data after TSNET_EVENT_CLOSE
+
+	size_t input_limit; // tsnet_set_recv_buffer(): max unconsumed bytes of a connection (0: no input buffer)
+	struct tsnet_slab slab; // send requests, tsnet_send() copies and input buffers
+	struct tsnet_framing framing; // tsnet_set_framing()
+	struct tsnet_timer_wheel timers;
+	uint64_t now; // ms (CLOCK_MONOTONIC), read once per loop turn
+	uint64_t idle_timeout, read_timeout, write_timeout; // tsnet_set_timeouts(): defaults of new connections
+
+	size_t send_low, send_high; // tsnet_set_send_watermarks(): queued bytes of a connection (0: no limit)
+	size_t total_low, total_high; // tsnet_set_total_send_watermarks(): queued bytes of the event loop (0: no limit)
+	size_t queued; // queued bytes of the event loop
+	struct tsnet_fd_list paused_list; // client fd paused by the total high watermark
+
+	char edge_trigger; // TSNET_EPOLL: client fd is registered once with EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET
+	struct tsnet_fd_list flush_list; // edge trigger: client fd that got new send requests, flushed before next epoll_wait()
+	size_t zerocopy_threshold; // TSNET_EPOLL: tsnet_send_owned() of this size or more uses MSG_ZEROCOPY (0: disabled)
+	struct tsnet_fd_list read_list; // edge trigger: client fd that used up its read budget with data left, read again before blocking
+	struct tsnet_fd_list complete_list; // client fd whose tsnet_send() finished without queueing (SEND_COMPLETE is fired from the loop)
+
+	struct tsnet_post_queue posts; // tsnet_post(), tsnet_send_async() from other threads
+	uint64_t conn_id; // id of the last accepted connection
+	struct tsnet_pool *pool; // tsnet_set_workers()
+	struct tsnet_pool *io_pool; // TSNET_EPOLL: reads cold files for tsnet_sendfile() (loop 0, started by the first cold window of any loop)
+	int io_workers; // tsnet_set_io_workers()
+
+	int loop_index; // 0: instance made by tsnet_create(), 1 ~ n: event loops made by tsnet_loop_threads()
+	int loop_count;
+	struct tsnet **loops; // only valid on loop 0
+	struct tsnet *parent; // loop 0 (1 ~ n: a failed loop stops it)
+	pthread_t thread;
+	char stop; // tsnet_loop() returns at its next turn (any thread, then posts.event_fd is written)
+	int loop_ret; // 1 ~ n: what tsnet_loop() returned, loop_error is its error message
+	char loop_error[BUFSIZ];
 
 	char is_bind;
 } TSNET;
 
 TSNET * tsnet_create(int type, int backlog, int max_client);
 void tsnet_set_user_data(TSNET *tsnet, void *user_data);
+void tsnet_set_conn_data_free(TSNET *tsnet, tsnet_conn_data_free_t conn_data_free);
+int tsnet_set_edge_trigger(TSNET *tsnet, char enable);
+int tsnet_set_zerocopy(TSNET *tsnet, size_t threshold);
+int tsnet_set_recv_buffer(TSNET *tsnet, size_t limit); /* with framing it is at least the largest frame */
+int tsnet_set_framing(TSNET *tsnet, int type, size_t size, uint8_t delimiter);
+int tsnet_set_timeouts(TSNET *tsnet, uint64_t idle_ms, uint64_t read_ms, uint64_t write_ms);
+int tsnet_set_send_watermarks(TSNET *tsnet, size_t low, size_t high);
+int tsnet_set_total_send_watermarks(TSNET *tsnet, size_t low, size_t high);
+int tsnet_set_huge_pages(TSNET *tsnet, char enable);
 void tsnet_delete(TSNET *tsnet);
 
 int tsnet_bind(TSNET *tsnet, const char *ip, uint16_t port);
 int tsnet_addListener(TSNET *tsnet, tsnet_event_t event, tsnet_cb_t cb);
 int tsnet_loop(TSNET *tsnet);
+int tsnet_loop_threads(TSNET *tsnet, int nthreads);
+int tsnet_get_loop_index(TSNET *tsnet);
+
+struct tsnet_timer * tsnet_timer_add(TSNET *tsnet, uint64_t timeout_ms, tsnet_timer_cb_t cb, void *arg); /* one shot, the handle is invalid once cb is called */
+int tsnet_timer_cancel(TSNET *tsnet, struct tsnet_timer *timer);
+
+/* thread safe: fn(tsnet, arg) runs on the event loop of tsnet (tsnet_loop_threads(): the TSNET given to the callbacks)
+ * exactly once: posts still queued run in tsnet_delete(), after the connections are closed */
+int tsnet_post(TSNET *tsnet, tsnet_post_cb_t fn, void *arg);
+int tsnet_send_async(TSNET *tsnet, socket_t client_fd, uint64_t conn_id, const void *data, size_t data_len); /* data is copied, tsnet_send() runs on the loop if client_fd is still conn_id */
+
+/* work stealing worker pool: work(arg) runs on a worker thread, then done(tsnet, arg) on the event loop of tsnet
+ * done always runs exactly once: a work tsnet_delete() finds not started gets it without work(arg) */
+int tsnet_set_workers(TSNET *tsnet, int nworkers /* 0: online CPUs */); /* before tsnet_loop(), tsnet_loop_threads() */
+int tsnet_work(TSNET *tsnet, tsnet_work_cb_t work, tsnet_post_cb_t done /* NULL: none */, void *arg);
+int tsnet_set_io_workers(TSNET *tsnet, int nworkers /* 0: tsnet_sendfile() may block the loop on disk */); /* TSNET_EPOLL, before tsnet_loop(), tsnet_loop_threads() */
 
 int tsnet_send(TSNET *tsnet, socket_t client_fd, const void *data, size_t data_len);
+int tsnet_send_owned(TSNET *tsnet, socket_t client_fd, void *buf, size_t buf_len, tsnet_free_t free_fn, void *arg); /* buf is released by free_fn(buf, arg) when sent, closed or failed */
 int tsnet_sendfile(TSNET *tsnet, socket_t client_fd, const char *file_path);
+int tsnet_consume(TSNET *tsnet, socket_t client_fd, size_t n);
+int tsnet_set_conn_timeouts(TSNET *tsnet, socket_t client_fd, uint64_t idle_ms, uint64_t read_ms, uint64_t write_ms);
 int tsnet_get_client_info(TSNET *tsnet, socket_t client_fd, struct tsnet_client *client);
+int tsnet_set_conn_data(TSNET *tsnet, socket_t client_fd, void *conn_data);
+void * tsnet_get_conn_data(TSNET *tsnet, socket_t client_fd);
+uint64_t tsnet_get_conn_id(TSNET *tsnet, socket_t client_fd); /* 0: not connected, taken on the loop for tsnet_send_async() and deferred work */
+int tsnet_get_zerocopy_stats(TSNET *tsnet, socket_t client_fd, size_t *sends, size_t *copied);
+int tsnet_get_slab_stats(TSNET *tsnet, struct tsnet_slab_stats *stats);
+struct tsnet_slab * tsnet_get_slab(TSNET *tsnet); /* for ht_create_slab() of tables used on this loop thread only */
 
 const char *tsnet_get_last_error();
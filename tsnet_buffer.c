@@ -0,0 +1,50 @@
+#include "tsnet_buffer.h"
+#include "tsnet_slab.h"
+
+/* make need bytes of room after input->end (compact first, grow if still short) */
+int tsnet_input_reserve(struct tsnet_slab *slab, struct tsnet_input *input, size_t need)
+{
+	size_t len, size;
+	uint8_t *buf;
+
+	if ( !input->buf && need <= TSNET_CHUNK_SIZE ) {
+		if ( !(input->buf = tsnet_slab_alloc(slab, TSNET_CHUNK_SIZE)) ) return -1;
+
+		input->size = TSNET_CHUNK_SIZE;
+		input->start = input->end = 0;
+		return 0;
+	}
+
+	if ( input->size - input->end >= need ) return 0;
+
+	len = input->end - input->start;
+
+	if ( input->size - len >= need ) {
+		memmove(input->buf, input->buf + input->start, len);
+		input->start = 0;
+		input->end = len;
+		return 0;
+	}
+
+	for ( size = input->size ? input->size << 1 : TSNET_CHUNK_SIZE; size - len < need; size = size << 1 ) {/* no action */}
+
+	if ( !(buf = tsnet_slab_alloc(slab, size)) ) return -1;
+
+	if ( len ) memcpy(buf, input->buf + input->start, len);
+
+	tsnet_input_release(slab, input);
+
+	input->buf = buf;
+	input->size = size;
+	input->start = 0;
+	input->end = len;
+
+	return 0;
+}
+
+void tsnet_input_release(struct tsnet_slab *slab, struct tsnet_input *input)
+{
+	if ( input->buf ) tsnet_slab_free(slab, input->buf, input->size);
+
+	memset(input, 0x00, sizeof(struct tsnet_input));
+}
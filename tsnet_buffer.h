@@ -0,0 +1,7 @@
+#include "tsnet.h"
+#include "tsnet_common_inter.h"
+
+#define TSNET_CHUNK_SIZE (BUFSIZ * 2) /* first input buffer of a connection, it doubles when more input is kept */
+
+int tsnet_input_reserve(struct tsnet_slab *slab, struct tsnet_input *input, size_t need);
+void tsnet_input_release(struct tsnet_slab *slab, struct tsnet_input *input);
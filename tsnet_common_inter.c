@@ -1,6 +1,6 @@
 #include "tsnet_common_inter.h"
 
-char tsnet_last_error[BUFSIZ] = {0};
+__thread char tsnet_last_error[BUFSIZ] = {0};
 
 void tsnet_set_last_error(const char *file, int line, const char *func, char *fmt, ...)
 {
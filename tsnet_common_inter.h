@@ -9,12 +9,20 @@
 #include <errno.h>
 #include <signal.h>
 #include <assert.h>
+#include <limits.h>
+#include <poll.h>
 #include <sys/epoll.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/sendfile.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
+#include <linux/errqueue.h>
 
 #define CKNUL(p) p ? "valid" : "null"
 #define safe_free(p) if ( p ) { free(p); p = NULL; }
@@ -24,9 +32,18 @@
 #define TSNET_DEFAULT_BACKLOG 64
 #define TSNET_DEFAULT_MAX_CLIENT 1024
 #define TSNET_MAX_RECV_BYTES (BUFSIZ * 16)
+#define TSNET_MIN_RECV_BYTES 1024
+#define TSNET_INIT_RECV_BYTES (BUFSIZ * 2) /* first recv() size of a connection, then it follows the message sizes */
+#define TSNET_RECV_BUDGET (TSNET_MAX_RECV_BYTES * 4) /* bytes read from one connection per event, so one client can't starve the others */
+#define TSNET_NOTSENT_LOWAT (BUFSIZ * 16) /* TCP_NOTSENT_LOWAT when send watermarks are set, the queue holds the rest */
+#define TSNET_MAX_IOV IOV_MAX /* max memory requests gathered by one sendmsg() */
+
+/* why reading a connection is stopped (send watermarks) */
+#define TSNET_PAUSE_CONN 0x01 /* its queue is over the high watermark */
+#define TSNET_PAUSE_TOTAL 0x02 /* queues of the event loop are over the total high watermark */
 
 #define TSNET_SET_ERROR(...) tsnet_set_last_error(__FILE__, __LINE__, __func__, __VA_ARGS__);
 
-extern char tsnet_last_error[BUFSIZ];
+extern __thread char tsnet_last_error[BUFSIZ]; // each event loop thread keeps its own error message
 
 void tsnet_set_last_error(const char *file, int line, const char *func, char *fmt, ...);
@@ -7,5 +7,6 @@ int epoll_event_control(int epfd, int op, int fd, uint32_t events)
 	ev.events = events;
 	ev.data.fd = fd;
 					
-	return events ? epoll_ctl(epfd, op, fd, &ev) : epoll_ctl(epfd, op, fd, NULL);
+	// MOD with no events keeps only EPOLLHUP / EPOLLERR (reading and writing are both stopped)
+	return op == EPOLL_CTL_DEL ? epoll_ctl(epfd, op, fd, NULL) : epoll_ctl(epfd, op, fd, &ev);
 }
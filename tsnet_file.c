@@ -0,0 +1,124 @@
+#include "tsnet_file.h"
+
+#if !defined(__NR_cachestat) && (defined(__x86_64__) || defined(__aarch64__))
+#define __NR_cachestat 451 /* same number on every architecture of the generic table */
+#endif
+
+static size_t page_size(void)
+{
+	static size_t size;
+
+	if ( !size ) {
+		long ret = sysconf(_SC_PAGESIZE);
+
+		size = ret > 0 ? (size_t)ret : 4096;
+	}
+
+	return size;
+}
+
+/* cachestat() (Linux 6.5): page cache pages of a range in one call, without a mapping */
+static int cachestat_resident(int fd, size_t offset, size_t len, size_t page)
+{
+#ifdef __NR_cachestat
+	static char unsupported;
+	struct { uint64_t off, len; } range = { offset, len };
+	struct { uint64_t nr_cache, nr_dirty, nr_writeback, nr_evicted, nr_recently_evicted; } stat;
+
+	if ( unsupported ) return -1;
+
+	if ( syscall(__NR_cachestat, fd, &range, &stat, 0) == 0 ) return stat.nr_cache >= ((offset + len + page - 1) / page - offset / page);
+	if ( errno == ENOSYS ) unsupported = 1;
+#endif
+
+	(void)fd, (void)offset, (void)len, (void)page;
+	return -1; // EPERM: newer kernels hide page cache of files the caller can't write, like mincore()
+}
+
+/* reads that refuse to wait for the disk: a short read or EAGAIN is a page not in page cache */
+static int nowait_resident(int fd, size_t offset, size_t len)
+{
+#ifdef RWF_NOWAIT
+	uint8_t buf[64 * 1024];
+
+	for ( size_t done = 0; done < len; ) {
+		size_t want = len - done < sizeof(buf) ? len - done : sizeof(buf);
+		struct iovec iov = { .iov_base = buf, .iov_len = want };
+		ssize_t nread = preadv2(fd, &iov, 1, offset + done, RWF_NOWAIT);
+
+		if ( nread < 0 && errno == EINTR ) continue;
+		if ( nread < 0 ) return errno == EAGAIN ? 0 : errno == EOPNOTSUPP || errno == EINVAL ? -1 : 1; // other errors: sendfile() reports them
+		if ( nread == 0 ) return 1; // end of file
+		if ( (size_t)nread < want ) return 0;
+
+		done += nread;
+	}
+
+	return 1;
+#else
+	(void)fd, (void)offset, (void)len;
+	return -1;
+#endif
+}
+
+/* mincore() reports every page of a file the caller neither owns nor can write as resident (Linux 5.1) */
+static int mincore_resident(int fd, size_t offset, size_t len, size_t page)
+{
+	size_t start = offset & ~(page - 1), map_len = offset + len - start, pages = (map_len + page - 1) / page;
+	unsigned char vec[TSNET_SENDFILE_WINDOW / 4096 + 2];
+	struct stat st;
+	int resident = 1;
+	void *map;
+
+	if ( fstat(fd, &st) < 0 || (st.st_uid != geteuid() && geteuid() != 0) ) return 1;
+
+	if ( pages > sizeof(vec) ) pages = sizeof(vec), map_len = pages * page;
+
+	// the mapping is never touched, mincore() only looks at page cache of the file
+	if ( (map = mmap(NULL, map_len, PROT_READ, MAP_SHARED, fd, start)) == MAP_FAILED ) return 1;
+
+	if ( mincore(map, map_len, vec) == 0 ) {
+		for ( size_t i = 0; i < pages; i++ ) {
+			if ( !(vec[i] & 1) ) {
+				resident = 0;
+				break;
+			}
+		}
+	}
+
+	(void)munmap(map, map_len);
+
+	return resident;
+}
+
+int tsnet_file_resident(int fd, size_t offset, size_t len)
+{
+	size_t page = page_size();
+	int ret;
+
+	if ( len == 0 ) return 1;
+
+	if ( (ret = cachestat_resident(fd, offset, len, page)) >= 0 ) return ret;
+	// copies the window when it is hot (older kernels only, cachestat() answers without it)
+	if ( (ret = nowait_resident(fd, offset, len)) >= 0 ) return ret;
+
+	return mincore_resident(fd, offset, len, page);
+}
+
+void tsnet_file_warm(void *arg)
+{
+	struct tsnet_file_read *file_read = arg;
+	uint8_t buf[64 * 1024];
+
+	// one large request for the window, then the reads wait for it
+	(void)readahead(file_read->file_fd, file_read->offset, file_read->len);
+
+	for ( size_t done = 0; done < file_read->len; ) {
+		ssize_t nread = pread(file_read->file_fd, buf, file_read->len - done < sizeof(buf) ? file_read->len - done : sizeof(buf), file_read->offset + done);
+
+		if ( nread < 0 && errno == EINTR ) continue;
+		if ( nread <= 0 ) break; // sendfile() reports it
+
+		done += nread;
+	}
+}
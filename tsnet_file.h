@@ -0,0 +1,12 @@
+#include "tsnet.h"
+#include "tsnet_common_inter.h"
+
+#define TSNET_IO_WORKERS 4 /* default I/O pool size (tsnet_set_io_workers()) */
+#define TSNET_SENDFILE_WINDOW (1024 * 1024) /* bytes checked (and read when cold) before sendfile() goes on */
+
+/* 1: offset ~ offset + len - 1 is in page cache (or it can't be told), 0: sendfile() would wait for the disk
+ * cachestat(), then preadv2(RWF_NOWAIT) over the range, mincore() only for files the process owns */
+int tsnet_file_resident(int fd, size_t offset, size_t len);
+
+/* I/O worker: reads struct tsnet_file_read into page cache */
+void tsnet_file_warm(void *arg);
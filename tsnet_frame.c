@@ -0,0 +1,71 @@
+#include "tsnet_frame.h"
+
+/* returns header bytes (0: more bytes are needed, -1: broken) */
+static int decode_varint(const uint8_t *data, size_t len, uint64_t *value)
+{
+	*value = 0;
+
+	for ( size_t i = 0; i < len && i < TSNET_FRAME_MAX_HEADER; i++ ) {
+		*value |= (uint64_t)(data[i] & 0x7f) << (7 * i);
+		if ( !(data[i] & 0x80) ) return i + 1;
+	}
+
+	return len < TSNET_FRAME_MAX_HEADER ? 0 : -1;
+}
+
+/*
+ * find the frame at the head of data
+ * returns 1: frame is complete (payload: data[offset] ~ data[offset + payload_len - 1], frame_len: bytes to consume)
+ *         0: more bytes are needed (frame_len: total size of the pending frame, 0 when not known yet)
+ *        -1: broken or larger than framing->size
+ * scanned keeps the bytes already searched for the delimiter, so a long line is not searched again from the head
+ */
+int tsnet_frame_decode(const struct tsnet_framing *framing, const uint8_t *data, size_t len, size_t *scanned, size_t *offset, size_t *payload_len, size_t *frame_len)
+{
+	int hdr_len = 0;
+	uint64_t value = 0;
+	const uint8_t *p;
+
+	*frame_len = 0;
+
+	switch ( framing->type ) {
+		case TSNET_FRAME_U16: // length prefix is in network byte order
+			if ( len < 2 ) return 0;
+			hdr_len = 2;
+			value = (uint64_t)data[0] << 8 | data[1];
+			break;
+		case TSNET_FRAME_U32:
+			if ( len < 4 ) return 0;
+			hdr_len = 4;
+			value = (uint64_t)data[0] << 24 | (uint64_t)data[1] << 16 | (uint64_t)data[2] << 8 | data[3];
+			break;
+		case TSNET_FRAME_VARINT: // protobuf style, 7 bits per byte (least significant group first)
+			if ( (hdr_len = decode_varint(data, len, &value)) <= 0 ) return hdr_len;
+			break;
+		case TSNET_FRAME_DELIMITER: // glibc memchr() is vectorized (SSE2/AVX2)
+			if ( !(p = memchr(data + *scanned, framing->delimiter, len - *scanned)) ) {
+				*scanned = len;
+				return len > framing->size ? -1 : 0;
+			}
+
+			*offset = 0;
+			*payload_len = p - data; // without the delimiter
+			*frame_len = *payload_len + 1;
+			*scanned = 0;
+			return *payload_len > framing->size ? -1 : 1;
+		case TSNET_FRAME_FIXED:
+			*offset = 0;
+			*payload_len = *frame_len = framing->size;
+			return len >= framing->size;
+		default:
+			return -1;
+	}
+
+	if ( value > framing->size ) return -1;
+
+	*offset = hdr_len;
+	*payload_len = value;
+	*frame_len = hdr_len + value;
+
+	return len >= *frame_len;
+}
@@ -0,0 +1,7 @@
+#include "tsnet.h"
+#include "tsnet_common_inter.h"
+
+#define TSNET_FRAME_MAX_HEADER 10 /* varint of uint64_t */
+#define TSNET_MAX_RCVLOWAT TSNET_MAX_RECV_BYTES /* SO_RCVLOWAT is capped, a larger frame wakes the loop more than once */
+
+int tsnet_frame_decode(const struct tsnet_framing *framing, const uint8_t *data, size_t len, size_t *scanned, size_t *offset, size_t *payload_len, size_t *frame_len);
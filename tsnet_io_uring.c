@@ -0,0 +1,242 @@
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "tsnet_io_uring.h"
+
+/* liburing is not required, the ring is driven by raw system calls */
+
+static int io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+	return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(int ring_fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+	return (int)syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int io_uring_enter_timeout(int ring_fd, unsigned to_submit, unsigned min_complete, int timeout_ms)
+{
+	struct __kernel_timespec ts;
+	struct io_uring_getevents_arg arg;
+
+	memset(&arg, 0x00, sizeof(arg));
+	ts.tv_sec = timeout_ms / 1000;
+	ts.tv_nsec = (long long)(timeout_ms % 1000) * 1000000;
+	arg.ts = (uint64_t)(uintptr_t)&ts;
+
+	return (int)syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+}
+
+static int io_uring_register(int ring_fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+	return (int)syscall(__NR_io_uring_register, ring_fd, opcode, arg, nr_args);
+}
+
+int tsnet_uring_init(struct tsnet_uring *ring, unsigned entries)
+{
+	struct io_uring_params p;
+
+	memset(ring, 0x00, sizeof(struct tsnet_uring));
+	memset(&p, 0x00, sizeof(p));
+
+	ring->ring_fd = -1;
+
+	if ( (ring->ring_fd = io_uring_setup(entries, &p)) < 0 ) {
+		TSNET_SET_ERROR("io_uring_setup() is failed: (errmsg: %s, errno: %d, entries: %u)", strerror(errno), errno, entries);
+		goto out;
+	}
+
+	ring->sq_map_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ring->cq_map_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if ( p.features & IORING_FEAT_SINGLE_MMAP ) {
+		if ( ring->cq_map_size > ring->sq_map_size ) ring->sq_map_size = ring->cq_map_size;
+		ring->cq_map_size = ring->sq_map_size;
+	}
+
+	ring->sq_ptr = mmap(NULL, ring->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_SQ_RING);
+	if ( ring->sq_ptr == MAP_FAILED ) {
+		ring->sq_ptr = NULL;
+		TSNET_SET_ERROR("mmap(IORING_OFF_SQ_RING) is failed: (errmsg: %s, errno: %d)", strerror(errno), errno);
+		goto out;
+	}
+
+	if ( p.features & IORING_FEAT_SINGLE_MMAP ) {
+		ring->cq_ptr = ring->sq_ptr;
+	}
+	else {
+		ring->cq_ptr = mmap(NULL, ring->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_CQ_RING);
+		if ( ring->cq_ptr == MAP_FAILED ) {
+			ring->cq_ptr = NULL;
+			TSNET_SET_ERROR("mmap(IORING_OFF_CQ_RING) is failed: (errmsg: %s, errno: %d)", strerror(errno), errno);
+			goto out;
+		}
+	}
+
+	ring->sqes_map_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_SQES);
+	if ( ring->sqes == MAP_FAILED ) {
+		ring->sqes = NULL;
+		TSNET_SET_ERROR("mmap(IORING_OFF_SQES) is failed: (errmsg: %s, errno: %d)", strerror(errno), errno);
+		goto out;
+	}
+
+	ring->sq_khead = (unsigned *)((char *)ring->sq_ptr + p.sq_off.head);
+	ring->sq_ktail = (unsigned *)((char *)ring->sq_ptr + p.sq_off.tail);
+	ring->sq_kmask = (unsigned *)((char *)ring->sq_ptr + p.sq_off.ring_mask);
+	ring->sq_array = (unsigned *)((char *)ring->sq_ptr + p.sq_off.array);
+	ring->sq_entries = p.sq_entries;
+
+	ring->cq_khead = (unsigned *)((char *)ring->cq_ptr + p.cq_off.head);
+	ring->cq_ktail = (unsigned *)((char *)ring->cq_ptr + p.cq_off.tail);
+	ring->cq_kmask = (unsigned *)((char *)ring->cq_ptr + p.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)((char *)ring->cq_ptr + p.cq_off.cqes);
+
+	// sqe index == sq array index, so the array is filled only once
+	for ( unsigned i = 0; i < ring->sq_entries; i++ ) ring->sq_array[i] = i;
+
+	return 0;
+
+out:
+	tsnet_uring_exit(ring);
+
+	return -1;
+}
+
+void tsnet_uring_exit(struct tsnet_uring *ring)
+{
+	if ( ring ) {
+		if ( ring->buf_ring ) munmap(ring->buf_ring, ring->buf_ring_size);
+		safe_free(ring->bufs);
+		if ( ring->sqes ) munmap(ring->sqes, ring->sqes_map_size);
+		if ( ring->cq_ptr && ring->cq_ptr != ring->sq_ptr ) munmap(ring->cq_ptr, ring->cq_map_size);
+		if ( ring->sq_ptr ) munmap(ring->sq_ptr, ring->sq_map_size);
+		safe_close(ring->ring_fd);
+
+		ring->buf_ring = NULL;
+		ring->sqes = NULL;
+		ring->sq_ptr = ring->cq_ptr = NULL;
+	}
+}
+
+static int tsnet_uring_flush(struct tsnet_uring *ring)
+{
+	unsigned to_submit = ring->sqe_tail - ring->sqe_head;
+
+	if ( to_submit ) {
+		__atomic_store_n(ring->sq_ktail, ring->sqe_tail, __ATOMIC_RELEASE);
+		ring->sqe_head = ring->sqe_tail;
+	}
+
+	return to_submit;
+}
+
+struct io_uring_sqe * tsnet_uring_get_sqe(struct tsnet_uring *ring)
+{
+	struct io_uring_sqe *sqe;
+
+	// submission queue is full, hand the pending sqes over to the kernel first
+	while ( ring->sqe_tail - __atomic_load_n(ring->sq_khead, __ATOMIC_ACQUIRE) >= ring->sq_entries ) {
+		if ( tsnet_uring_submit_and_wait(ring, 0, -1) < 0 ) return NULL;
+	}
+
+	sqe = &ring->sqes[ring->sqe_tail & *ring->sq_kmask];
+	ring->sqe_tail++;
+
+	memset(sqe, 0x00, sizeof(struct io_uring_sqe));
+
+	return sqe;
+}
+
+/* timeout_ms: -1 waits for wait_nr completions without a time limit */
+int tsnet_uring_submit_and_wait(struct tsnet_uring *ring, unsigned wait_nr, int timeout_ms)
+{
+	int ret;
+	unsigned to_submit = tsnet_uring_flush(ring);
+
+	if ( !to_submit && !wait_nr ) return 0;
+
+	do {
+		if ( wait_nr && timeout_ms >= 0 ) ret = io_uring_enter_timeout(ring->ring_fd, to_submit, wait_nr, timeout_ms);
+		else ret = io_uring_enter(ring->ring_fd, to_submit, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0);
+	} while ( ret < 0 && errno == EINTR );
+
+	if ( ret < 0 && errno == ETIME ) return 0; // timer expiry is due, no completion
+
+	if ( ret < 0 ) {
+		TSNET_SET_ERROR("io_uring_enter() is failed: (errmsg: %s, errno: %d, to_submit: %u)", strerror(errno), errno, to_submit);
+		return -1;
+	}
+
+	return ret;
+}
+
+struct io_uring_cqe * tsnet_uring_peek_cqe(struct tsnet_uring *ring)
+{
+	unsigned head = *ring->cq_khead;
+
+	if ( head == __atomic_load_n(ring->cq_ktail, __ATOMIC_ACQUIRE) ) return NULL;
+
+	return &ring->cqes[head & *ring->cq_kmask];
+}
+
+void tsnet_uring_cqe_seen(struct tsnet_uring *ring)
+{
+	__atomic_store_n(ring->cq_khead, *ring->cq_khead + 1, __ATOMIC_RELEASE);
+}
+
+int tsnet_uring_setup_buffers(struct tsnet_uring *ring, unsigned count, unsigned size)
+{
+	struct io_uring_buf_reg reg;
+
+	ring->buf_count = count;
+	ring->buf_size = size;
+	ring->buf_ring_size = count * sizeof(struct io_uring_buf);
+
+	ring->buf_ring = mmap(NULL, ring->buf_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if ( ring->buf_ring == MAP_FAILED ) {
+		ring->buf_ring = NULL;
+		TSNET_SET_ERROR("mmap() is failed: (errmsg: %s, errno: %d, size: %lu)", strerror(errno), errno, ring->buf_ring_size);
+		goto out;
+	}
+
+	if ( !(ring->bufs = malloc((size_t)count * size)) ) {
+		TSNET_SET_ERROR("malloc() is failed: (errmsg: %s, errno: %d, size: %lu)", strerror(errno), errno, (size_t)count * size);
+		goto out;
+	}
+
+	memset(&reg, 0x00, sizeof(reg));
+	reg.ring_addr = (uint64_t)(uintptr_t)ring->buf_ring;
+	reg.ring_entries = count;
+	reg.bgid = TSNET_URING_BUF_GROUP;
+
+	if ( io_uring_register(ring->ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0 ) {
+		TSNET_SET_ERROR("io_uring_register(IORING_REGISTER_PBUF_RING) is failed: (errmsg: %s, errno: %d)", strerror(errno), errno);
+		goto out;
+	}
+
+	ring->buf_ring->tail = 0;
+	for ( unsigned bid = 0; bid < count; bid++ ) tsnet_uring_recycle_buffer(ring, bid);
+
+	return 0;
+
+out:
+	return -1;
+}
+
+uint8_t * tsnet_uring_buffer(struct tsnet_uring *ring, unsigned bid)
+{
+	return ring->bufs + (size_t)bid * ring->buf_size;
+}
+
+void tsnet_uring_recycle_buffer(struct tsnet_uring *ring, unsigned bid)
+{
+	unsigned short tail = ring->buf_ring->tail;
+	struct io_uring_buf *buf = &ring->buf_ring->bufs[tail & (ring->buf_count - 1)];
+
+	buf->addr = (uint64_t)(uintptr_t)tsnet_uring_buffer(ring, bid);
+	buf->len = ring->buf_size;
+	buf->bid = bid;
+
+	__atomic_store_n(&ring->buf_ring->tail, (unsigned short)(tail + 1), __ATOMIC_RELEASE);
+}
@@ -0,0 +1,59 @@
+#include "tsnet_common_inter.h"
+
+#include <linux/io_uring.h>
+
+#define TSNET_URING_ENTRIES 1024
+#define TSNET_URING_BUF_GROUP 0
+#define TSNET_URING_BUF_COUNT 512 /* provided recv buffers (must be 2^n) */
+#define TSNET_URING_BUF_SIZE (BUFSIZ * 2)
+#define TSNET_URING_SPLICE_CHUNK 65536 /* default pipe capacity */
+
+/* sqe/cqe user_data: op (high 32bit) | fd (low 32bit) */
+#define TSNET_URING_DATA(op, fd) (((uint64_t)(op) << 32) | (uint32_t)(fd))
+#define TSNET_URING_DATA_OP(data) ((int)((data) >> 32))
+#define TSNET_URING_DATA_FD(data) ((int)((data) & 0xffffffff))
+
+enum tsnet_uring_op {
+	TSNET_URING_ACCEPT = 1,
+	TSNET_URING_RECV,
+	TSNET_URING_SEND,
+	TSNET_URING_SPLICE_IN, /* sendfile fd -> pipe */
+	TSNET_URING_SPLICE_OUT, /* pipe -> client fd */
+	TSNET_URING_CANCEL,
+	TSNET_URING_WAKEUP /* event_fd of tsnet_post() */
+};
+
+struct tsnet_uring {
+	int ring_fd;
+
+	/* submission queue */
+	unsigned *sq_khead, *sq_ktail, *sq_kmask, *sq_array;
+	unsigned sq_entries;
+	unsigned sqe_head, sqe_tail; // sqe_tail - sqe_head: not yet submitted
+	struct io_uring_sqe *sqes;
+
+	/* completion queue */
+	unsigned *cq_khead, *cq_ktail, *cq_kmask;
+	struct io_uring_cqe *cqes;
+
+	void *sq_ptr, *cq_ptr;
+	size_t sq_map_size, cq_map_size, sqes_map_size;
+
+	/* provided buffer ring for multishot recv */
+	struct io_uring_buf_ring *buf_ring;
+	size_t buf_ring_size;
+	uint8_t *bufs;
+	unsigned buf_count, buf_size;
+};
+
+int tsnet_uring_init(struct tsnet_uring *ring, unsigned entries);
+void tsnet_uring_exit(struct tsnet_uring *ring);
+
+struct io_uring_sqe * tsnet_uring_get_sqe(struct tsnet_uring *ring);
+int tsnet_uring_submit_and_wait(struct tsnet_uring *ring, unsigned wait_nr, int timeout_ms);
+struct io_uring_cqe * tsnet_uring_peek_cqe(struct tsnet_uring *ring);
+void tsnet_uring_cqe_seen(struct tsnet_uring *ring);
+
+int tsnet_uring_setup_buffers(struct tsnet_uring *ring, unsigned count, unsigned size);
+uint8_t * tsnet_uring_buffer(struct tsnet_uring *ring, unsigned bid);
+void tsnet_uring_recycle_buffer(struct tsnet_uring *ring, unsigned bid);
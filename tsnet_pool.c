@@ -0,0 +1,301 @@
+#include "tsnet_pool.h"
+#include "tsnet_post.h"
+
+#define TSNET_DEQUE_MASK (TSNET_WORK_DEQUE - 1)
+
+static __thread struct tsnet_worker *current_worker; // set on pool threads
+
+/* owner only: -1 when full */
+static int deque_push(struct tsnet_worker *worker, struct tsnet_work *work)
+{
+	int64_t bottom = __atomic_load_n(&worker->bottom, __ATOMIC_RELAXED);
+	int64_t top = __atomic_load_n(&worker->top, __ATOMIC_ACQUIRE);
+
+	if ( bottom - top >= TSNET_WORK_DEQUE ) return -1;
+
+	__atomic_store_n(&worker->deque[bottom & TSNET_DEQUE_MASK], work, __ATOMIC_RELAXED);
+	__atomic_store_n(&worker->bottom, bottom + 1, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+/* owner only: newest first (its data is still in cache), races with thieves for the last one */
+static struct tsnet_work * deque_take(struct tsnet_worker *worker)
+{
+	int64_t bottom = __atomic_load_n(&worker->bottom, __ATOMIC_RELAXED) - 1, top;
+	struct tsnet_work *work = NULL;
+
+	__atomic_store_n(&worker->bottom, bottom, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	top = __atomic_load_n(&worker->top, __ATOMIC_RELAXED);
+
+	if ( top <= bottom ) {
+		work = __atomic_load_n(&worker->deque[bottom & TSNET_DEQUE_MASK], __ATOMIC_RELAXED);
+		if ( top != bottom ) return work;
+
+		if ( !__atomic_compare_exchange_n(&worker->top, &top, top + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED) ) work = NULL;
+	}
+
+	__atomic_store_n(&worker->bottom, bottom + 1, __ATOMIC_RELAXED);
+
+	return work;
+}
+
+/* any thread: oldest first, NULL when empty or another thief won */
+static struct tsnet_work * deque_steal(struct tsnet_worker *worker)
+{
+	int64_t top = __atomic_load_n(&worker->top, __ATOMIC_ACQUIRE), bottom;
+	struct tsnet_work *work;
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	bottom = __atomic_load_n(&worker->bottom, __ATOMIC_ACQUIRE);
+
+	if ( top >= bottom ) return NULL;
+
+	work = __atomic_load_n(&worker->deque[top & TSNET_DEQUE_MASK], __ATOMIC_RELAXED);
+	if ( !__atomic_compare_exchange_n(&worker->top, &top, top + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED) ) return NULL;
+
+	return work;
+}
+
+static int deque_size(struct tsnet_worker *worker)
+{
+	int64_t size = __atomic_load_n(&worker->bottom, __ATOMIC_ACQUIRE) - __atomic_load_n(&worker->top, __ATOMIC_ACQUIRE);
+
+	return size > 0 ? (int)size : 0;
+}
+
+/* pool->lock held: a fair share of the inject list goes to the deque (the rest of the pool can steal it) */
+static struct tsnet_work * grab_locked(struct tsnet_worker *worker)
+{
+	struct tsnet_pool *pool = worker->pool;
+	struct tsnet_work *first = pool->inject_head, *work;
+	size_t count = pool->inject_count / pool->count + 1, room = TSNET_WORK_DEQUE - deque_size(worker);
+
+	if ( !first ) return NULL;
+
+	if ( count > room + 1 ) count = room + 1;
+
+	pool->inject_head = (struct tsnet_work *)first->post.next;
+	pool->inject_count--;
+
+	for ( size_t i = 1; i < count && (work = pool->inject_head); i++ ) {
+		pool->inject_head = (struct tsnet_work *)work->post.next;
+		pool->inject_count--;
+		(void)deque_push(worker, work);
+	}
+
+	if ( !pool->inject_head ) pool->inject_tail = NULL;
+
+	// more than this worker can run now: wake a thief
+	if ( deque_size(worker) > 0 && pool->idle > 0 ) pthread_cond_signal(&pool->cond);
+
+	return first;
+}
+
+static struct tsnet_work * steal(struct tsnet_worker *worker)
+{
+	struct tsnet_pool *pool = worker->pool;
+	struct tsnet_work *work;
+
+	for ( int i = 1; i < pool->count; i++ ) {
+		struct tsnet_worker *victim = &pool->workers[(worker->index + i) % pool->count];
+
+		if ( (work = deque_steal(victim)) ) {
+			worker->steals++;
+
+			// the victim still has a backlog: one more sleeper can help
+			if ( deque_size(victim) > 0 && __atomic_load_n(&pool->idle, __ATOMIC_RELAXED) > 0 ) {
+				pthread_mutex_lock(&pool->lock);
+				if ( pool->idle > 0 ) pthread_cond_signal(&pool->cond);
+				pthread_mutex_unlock(&pool->lock);
+			}
+			return work;
+		}
+	}
+
+	return NULL;
+}
+
+/* the node is the completion: posted to its loop as is (freed there), or freed here without done callback */
+static void run_work(struct tsnet_work *work)
+{
+	TSNET *loop = work->loop;
+
+	work->work(work->post.arg);
+
+	if ( !work->post.fn ) {
+		free(work);
+		return;
+	}
+
+	tsnet_post_push(&loop->posts, &work->post);
+	(void)tsnet_post_wakeup(&loop->posts);
+}
+
+static void * worker_main(void *arg)
+{
+	struct tsnet_worker *worker = arg;
+	struct tsnet_pool *pool = worker->pool;
+	struct tsnet_work *work;
+
+	current_worker = worker;
+
+	for ( ;; ) {
+		if ( !(work = deque_take(worker)) ) {
+			pthread_mutex_lock(&pool->lock);
+			work = grab_locked(worker);
+			pthread_mutex_unlock(&pool->lock);
+		}
+
+		if ( !work ) work = steal(worker);
+
+		if ( work ) {
+			run_work(work);
+			worker->works++;
+			continue;
+		}
+
+		// nothing anywhere: sleep until a submit (or a busy worker with a full deque) signals
+		pthread_mutex_lock(&pool->lock);
+		if ( pool->stop ) {
+			pthread_mutex_unlock(&pool->lock);
+			break;
+		}
+
+		if ( !pool->inject_head ) {
+			// atomic: submitters and thieves peek at it without the lock
+			__atomic_add_fetch(&pool->idle, 1, __ATOMIC_RELAXED);
+			pthread_cond_wait(&pool->cond, &pool->lock);
+			__atomic_sub_fetch(&pool->idle, 1, __ATOMIC_RELAXED);
+		}
+		pthread_mutex_unlock(&pool->lock);
+	}
+
+	return NULL;
+}
+
+struct tsnet_pool * tsnet_pool_create(TSNET *owner, int nworkers)
+{
+	struct tsnet_pool *pool = NULL;
+	int ret;
+
+	if ( nworkers <= 0 && (nworkers = (int)sysconf(_SC_NPROCESSORS_ONLN)) <= 0 ) nworkers = 1;
+	if ( nworkers > TSNET_POOL_MAX_WORKERS ) nworkers = TSNET_POOL_MAX_WORKERS;
+
+	if ( !(pool = calloc(1, sizeof(struct tsnet_pool))) ) {
+		TSNET_SET_ERROR("calloc() is failed: (errmsg: %s, errno: %d, size: %lu)", strerror(errno), errno, sizeof(struct tsnet_pool));
+		goto out;
+	}
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->cond, NULL);
+	pool->owner = owner;
+	pool->count = nworkers;
+
+	// each deque head on its own cache lines (thieves CAS top, the owner moves bottom)
+	if ( (ret = posix_memalign((void **)&pool->workers, 64, sizeof(struct tsnet_worker) * nworkers)) != 0 ) {
+		pool->workers = NULL;
+		TSNET_SET_ERROR("posix_memalign() is failed: (errmsg: %s, errno: %d, size: %lu)", strerror(ret), ret, sizeof(struct tsnet_worker) * nworkers);
+		goto out;
+	}
+	memset(pool->workers, 0x00, sizeof(struct tsnet_worker) * nworkers);
+
+	for ( int i = 0; i < nworkers; i++ ) {
+		pool->workers[i].pool = pool;
+		pool->workers[i].index = i;
+	}
+
+	for ( ; pool->started < nworkers; pool->started++ ) {
+		if ( (ret = pthread_create(&pool->workers[pool->started].thread, NULL, worker_main, &pool->workers[pool->started])) != 0 ) {
+			TSNET_SET_ERROR("pthread_create() is failed: (errmsg: %s, errno: %d)", strerror(ret), ret);
+			goto out;
+		}
+	}
+
+	return pool;
+
+out:
+	if ( pool ) tsnet_pool_delete(pool);
+
+	return NULL;
+}
+
+/* tsnet_pool_stop(): a work never run still gets its done callback, on its loop without work() */
+static void return_work(struct tsnet_work *work)
+{
+	if ( !work->post.fn ) {
+		free(work);
+		return;
+	}
+
+	tsnet_post_push(&work->loop->posts, &work->post);
+}
+
+void tsnet_pool_stop(struct tsnet_pool *pool)
+{
+	struct tsnet_work *work;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->stop = 1;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	// counted down, so tsnet_pool_delete() after it joins nothing
+	for ( ; pool->started > 0; pool->started-- ) (void)pthread_join(pool->workers[pool->started - 1].thread, NULL);
+
+	// workers stop only once they find nothing: whatever is left was queued after that
+	while ( (work = pool->inject_head) ) {
+		pool->inject_head = (struct tsnet_work *)work->post.next;
+		return_work(work);
+	}
+	pool->inject_tail = NULL;
+
+	for ( int i = 0; pool->workers && i < pool->count; i++ ) {
+		while ( (work = deque_take(&pool->workers[i])) ) return_work(work);
+	}
+}
+
+void tsnet_pool_delete(struct tsnet_pool *pool)
+{
+	tsnet_pool_stop(pool);
+
+	free(pool->workers);
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->cond);
+	free(pool);
+}
+
+int tsnet_pool_submit(struct tsnet_pool *pool, struct tsnet_work *work)
+{
+	struct tsnet_worker *worker = current_worker;
+
+	work->post.next = NULL;
+
+	// nested work from a worker of this pool: its own deque, no lock
+	if ( worker && worker->pool == pool && deque_push(worker, work) == 0 ) {
+		if ( __atomic_load_n(&pool->idle, __ATOMIC_RELAXED) > 0 ) {
+			pthread_mutex_lock(&pool->lock);
+			if ( pool->idle > 0 ) pthread_cond_signal(&pool->cond);
+			pthread_mutex_unlock(&pool->lock);
+		}
+		return 0;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	if ( pool->stop ) {
+		pthread_mutex_unlock(&pool->lock);
+		TSNET_SET_ERROR("the worker pool is stopped");
+		return -1;
+	}
+
+	if ( pool->inject_tail ) pool->inject_tail->post.next = &work->post;
+	else pool->inject_head = work;
+	pool->inject_tail = work;
+	pool->inject_count++;
+
+	if ( pool->idle > 0 ) pthread_cond_signal(&pool->cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	return 0;
+}
@@ -0,0 +1,11 @@
+#include "tsnet.h"
+#include "tsnet_common_inter.h"
+
+#define TSNET_POOL_MAX_WORKERS 256
+
+struct tsnet_pool * tsnet_pool_create(TSNET *owner, int nworkers);
+void tsnet_pool_stop(struct tsnet_pool *pool); /* joins the workers, works never run are posted to their loops (done without work) */
+void tsnet_pool_delete(struct tsnet_pool *pool); /* stops it first, the loops of queued works must still be there */
+
+/* any thread (a worker pushes to its own deque) */
+int tsnet_pool_submit(struct tsnet_pool *pool, struct tsnet_work *work);
@@ -0,0 +1,97 @@
+#include "tsnet_post.h"
+
+int tsnet_post_init(struct tsnet_post_queue *queue)
+{
+	memset(queue, 0x00, sizeof(struct tsnet_post_queue));
+	queue->head = queue->tail = &queue->stub;
+
+	if ( (queue->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0 ) {
+		TSNET_SET_ERROR("eventfd() is failed: (errmsg: %s, errno: %d)", strerror(errno), errno);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* posts never run are dropped (no thread may push any more) */
+void tsnet_post_clear(struct tsnet_post_queue *queue)
+{
+	struct tsnet_post *post;
+
+	if ( !queue->head ) return; // never initialized
+
+	while ( (post = tsnet_post_pop(queue)) ) free(post);
+
+	safe_close(queue->event_fd);
+}
+
+/* any thread: one exchange, the node is linked to the previous one right after */
+void tsnet_post_push(struct tsnet_post_queue *queue, struct tsnet_post *post)
+{
+	struct tsnet_post *prev;
+
+	__atomic_store_n(&post->next, NULL, __ATOMIC_RELAXED);
+	prev = __atomic_exchange_n(&queue->head, post, __ATOMIC_ACQ_REL);
+	__atomic_store_n(&prev->next, post, __ATOMIC_RELEASE);
+}
+
+/* any thread: event_fd is written once until the loop runs the queue */
+int tsnet_post_wakeup(struct tsnet_post_queue *queue)
+{
+	uint64_t one = 1;
+
+	if ( __atomic_exchange_n(&queue->wake, 1, __ATOMIC_SEQ_CST) ) return 0;
+
+	if ( write(queue->event_fd, &one, sizeof(one)) < 0 && errno != EAGAIN ) {
+		TSNET_SET_ERROR("write(eventfd) is failed: (errmsg: %s, errno: %d)", strerror(errno), errno);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* NULL: empty, or a producer has not linked its node yet (tsnet_post_empty() tells) */
+struct tsnet_post * tsnet_post_pop(struct tsnet_post_queue *queue)
+{
+	struct tsnet_post *tail = queue->tail, *next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+
+	if ( tail == &queue->stub ) {
+		if ( !next ) return NULL;
+
+		queue->tail = tail = next;
+		next = __atomic_load_n(&next->next, __ATOMIC_ACQUIRE);
+	}
+
+	if ( next ) {
+		queue->tail = next;
+		return tail;
+	}
+
+	if ( tail != __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE) ) return NULL;
+
+	// the last node can't be taken while it is the head, the stub goes behind it
+	tsnet_post_push(queue, &queue->stub);
+
+	if ( (next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE)) ) {
+		queue->tail = next;
+		return tail;
+	}
+
+	return NULL;
+}
+
+int tsnet_post_empty(struct tsnet_post_queue *queue)
+{
+	return queue->tail == &queue->stub && !__atomic_load_n(&queue->stub.next, __ATOMIC_ACQUIRE);
+}
+
+/* the loop is running the queue: later pushes must write event_fd again */
+void tsnet_post_ack(struct tsnet_post_queue *queue)
+{
+	uint64_t counter;
+
+	(void)read(queue->event_fd, &counter, sizeof(counter));
+
+	// an exchange (not a store): it reads the flag of the last producer, so its node is visible to the pops after it
+	(void)__atomic_exchange_n(&queue->wake, 0, __ATOMIC_ACQ_REL);
+}
@@ -0,0 +1,15 @@
+#include "tsnet.h"
+#include "tsnet_common_inter.h"
+
+#define TSNET_POST_BATCH 256 /* posts run by one loop turn, the rest waits for the next turn (I/O is not starved) */
+
+int tsnet_post_init(struct tsnet_post_queue *queue);
+void tsnet_post_clear(struct tsnet_post_queue *queue);
+
+void tsnet_post_push(struct tsnet_post_queue *queue, struct tsnet_post *post);
+int tsnet_post_wakeup(struct tsnet_post_queue *queue);
+
+/* event loop thread only */
+struct tsnet_post * tsnet_post_pop(struct tsnet_post_queue *queue);
+int tsnet_post_empty(struct tsnet_post_queue *queue);
+void tsnet_post_ack(struct tsnet_post_queue *queue);
@@ -0,0 +1,240 @@
+#include "tsnet_slab.h"
+
+/* class of size: 16 ~ 128 by 16, then 4 classes between two powers of two (at most 25% waste) */
+static size_t slab_class_index(size_t size)
+{
+	size_t b;
+
+	if ( size <= 128 ) return size ? (size - 1) >> 4 : 0;
+
+	b = 63 - __builtin_clzl(size - 1); // 2^b < size <= 2^(b + 1)
+
+	return 8 + (b - 7) * 4 + ((size - 1 - ((size_t)1 << b)) >> (b - 2));
+}
+
+static size_t slab_class_size(size_t index)
+{
+	size_t b;
+
+	if ( index < 8 ) return (index + 1) << 4;
+
+	b = 7 + (index - 8) / 4;
+
+	return ((size_t)1 << b) + (((index - 8) % 4 + 1) << (b - 2));
+}
+
+static void link_partial(struct tsnet_slab_class *cls, struct tsnet_slab_page *page)
+{
+	page->prev = NULL;
+	if ( (page->next = cls->partial) ) page->next->prev = page;
+	cls->partial = page;
+}
+
+static void unlink_partial(struct tsnet_slab_class *cls, struct tsnet_slab_page *page)
+{
+	if ( page->prev ) page->prev->next = page->next;
+	else cls->partial = page->next;
+	if ( page->next ) page->next->prev = page->prev;
+
+	page->next = page->prev = NULL;
+}
+
+/* slab_bytes aligned mapping (an object finds its slab header by masking its address) */
+static void * map_slab(struct tsnet_slab *slab, char *huge)
+{
+	uint8_t *p, *aligned;
+	size_t bytes = slab->slab_bytes;
+
+	*huge = 0;
+
+	// hugetlb mappings are aligned to the huge page size already
+	if ( slab->huge ) {
+		p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if ( p != MAP_FAILED ) {
+			*huge = 1;
+			return p;
+		}
+	}
+
+	// map twice the size and trim both ends
+	if ( (p = mmap(NULL, bytes << 1, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED ) {
+		TSNET_SET_ERROR("mmap() is failed: (errmsg: %s, errno: %d, size: %lu)", strerror(errno), errno, bytes << 1);
+		return NULL;
+	}
+
+	aligned = (uint8_t *)(((uintptr_t)p + bytes - 1) & ~(uintptr_t)(bytes - 1));
+	if ( aligned > p ) munmap(p, aligned - p);
+	if ( p + (bytes << 1) > aligned + bytes ) munmap(aligned + bytes, p + (bytes << 1) - (aligned + bytes));
+
+	// no reserved huge pages, transparent huge pages may still back it
+	if ( slab->huge ) (void)madvise(aligned, bytes, MADV_HUGEPAGE);
+
+	return aligned;
+}
+
+static struct tsnet_slab_page * new_slab(struct tsnet_slab *slab, uint8_t index)
+{
+	struct tsnet_slab_class *cls = &slab->classes[index];
+	struct tsnet_slab_page *page;
+	char huge;
+
+	if ( !(page = map_slab(slab, &huge)) ) return NULL;
+
+	// objects are cut lazily with bump, untouched pages of the slab are not faulted in
+	memset(page, 0x00, sizeof(struct tsnet_slab_page));
+	page->bump = (uint8_t *)page + TSNET_SLAB_HEADER;
+	page->total = (slab->slab_bytes - TSNET_SLAB_HEADER) / cls->size;
+	page->cls = index;
+	page->huge = huge;
+
+	if ( (page->all_next = slab->slabs) ) page->all_next->all_prev = page;
+	slab->slabs = page;
+
+	link_partial(cls, page);
+	cls->slabs++;
+	cls->capacity += page->total;
+	if ( huge ) slab->huge_slabs++;
+
+	return page;
+}
+
+static void free_slab(struct tsnet_slab *slab, struct tsnet_slab_page *page)
+{
+	struct tsnet_slab_class *cls = &slab->classes[page->cls];
+
+	if ( page->all_prev ) page->all_prev->all_next = page->all_next;
+	else slab->slabs = page->all_next;
+	if ( page->all_next ) page->all_next->all_prev = page->all_prev;
+
+	cls->slabs--;
+	cls->capacity -= page->total;
+	if ( page->huge ) slab->huge_slabs--;
+
+	munmap(page, slab->slab_bytes);
+}
+
+int tsnet_slab_init(struct tsnet_slab *slab, char huge)
+{
+	if ( tsnet_slab_in_use(slab) ) {
+		TSNET_SET_ERROR("slab is in use: (large: %lu)", slab->large);
+		return -1;
+	}
+
+	tsnet_slab_clear(slab);
+
+	slab->huge = huge ? 1 : 0;
+	slab->slab_bytes = huge ? TSNET_SLAB_HUGE_BYTES : TSNET_SLAB_BYTES;
+
+	for ( size_t i = 0; i < TSNET_SLAB_CLASSES; i++ ) slab->classes[i].size = slab_class_size(i);
+
+	return 0;
+}
+
+/* every object must be freed before (slabs are unmapped, large allocations are not known) */
+void tsnet_slab_clear(struct tsnet_slab *slab)
+{
+	while ( slab->slabs ) free_slab(slab, slab->slabs);
+
+	memset(slab, 0x00, sizeof(struct tsnet_slab));
+}
+
+int tsnet_slab_in_use(struct tsnet_slab *slab)
+{
+	if ( slab->large ) return 1;
+
+	for ( size_t i = 0; i < TSNET_SLAB_CLASSES; i++ ) {
+		if ( slab->classes[i].used ) return 1;
+	}
+
+	return 0;
+}
+
+void * tsnet_slab_alloc(struct tsnet_slab *slab, size_t size)
+{
+	struct tsnet_slab_class *cls;
+	struct tsnet_slab_page *page;
+	size_t index;
+	void *obj;
+
+	if ( size > TSNET_SLAB_MAX_SIZE ) {
+		if ( !(obj = malloc(size)) ) {
+			TSNET_SET_ERROR("malloc() is failed: (errmsg: %s, errno: %d, size: %lu)", strerror(errno), errno, size);
+			return NULL;
+		}
+
+		slab->large++;
+		slab->large_bytes += size;
+		return obj;
+	}
+
+	index = slab_class_index(size);
+	cls = &slab->classes[index];
+
+	if ( !(page = cls->partial) && !(page = new_slab(slab, index)) ) return NULL;
+
+	if ( (obj = page->free_list) ) page->free_list = *(void **)obj;
+	else {
+		obj = page->bump;
+		page->bump += cls->size;
+	}
+
+	cls->used++;
+	if ( ++page->used == page->total ) unlink_partial(cls, page);
+
+	return obj;
+}
+
+/* size: the size given to tsnet_slab_alloc() */
+void tsnet_slab_free(struct tsnet_slab *slab, void *ptr, size_t size)
+{
+	struct tsnet_slab_class *cls;
+	struct tsnet_slab_page *page;
+
+	if ( !ptr ) return;
+
+	if ( size > TSNET_SLAB_MAX_SIZE ) {
+		free(ptr);
+		slab->large--;
+		slab->large_bytes -= size;
+		return;
+	}
+
+	page = (struct tsnet_slab_page *)((uintptr_t)ptr & ~(uintptr_t)(slab->slab_bytes - 1));
+	cls = &slab->classes[page->cls];
+
+	*(void **)ptr = page->free_list;
+	page->free_list = ptr;
+
+	if ( page->used-- == page->total ) link_partial(cls, page);
+	cls->used--;
+
+	// an empty slab is returned, unless it is the only one left with room (no map/unmap ping-pong)
+	if ( page->used == 0 && (page->next || page->prev) ) {
+		unlink_partial(cls, page);
+		free_slab(slab, page);
+	}
+}
+
+void tsnet_slab_stats(struct tsnet_slab *slab, struct tsnet_slab_stats *stats)
+{
+	memset(stats, 0x00, sizeof(struct tsnet_slab_stats));
+
+	stats->slab_bytes = slab->slab_bytes;
+	stats->huge_slabs = slab->huge_slabs;
+	stats->large = slab->large;
+	stats->large_bytes = slab->large_bytes;
+
+	for ( size_t i = 0; i < TSNET_SLAB_CLASSES; i++ ) {
+		struct tsnet_slab_class *cls = &slab->classes[i];
+
+		stats->classes[i].size = cls->size;
+		stats->classes[i].slabs = cls->slabs;
+		stats->classes[i].used = cls->used;
+		stats->classes[i].capacity = cls->capacity;
+
+		stats->slabs += cls->slabs;
+		stats->used += cls->used * cls->size;
+	}
+
+	stats->mapped = stats->slabs * slab->slab_bytes;
+}
@@ -0,0 +1,17 @@
+#include "tsnet.h"
+#include "tsnet_common_inter.h"
+
+/* size class slab allocator: objects of up to TSNET_SLAB_MAX_SIZE bytes are cut from aligned slabs, larger ones use malloc() */
+#define TSNET_SLAB_MAX_SIZE 16384 /* largest class (TSNET_SLAB_CLASSES - 1) */
+#define TSNET_SLAB_BYTES (256 * 1024) /* slab size, slabs are aligned to it (object -> slab header is a mask) */
+#define TSNET_SLAB_HUGE_BYTES (2 * 1024 * 1024) /* slab size with huge pages */
+#define TSNET_SLAB_HEADER 64 /* objects start after the slab header (cache line) */
+
+int tsnet_slab_init(struct tsnet_slab *slab, char huge);
+void tsnet_slab_clear(struct tsnet_slab *slab);
+int tsnet_slab_in_use(struct tsnet_slab *slab);
+
+void * tsnet_slab_alloc(struct tsnet_slab *slab, size_t size);
+void tsnet_slab_free(struct tsnet_slab *slab, void *ptr, size_t size);
+
+void tsnet_slab_stats(struct tsnet_slab *slab, struct tsnet_slab_stats *stats);
@@ -0,0 +1,189 @@
+#include <time.h>
+
+#include "tsnet_timer.h"
+
+uint64_t tsnet_timer_clock(void)
+{
+	struct timespec ts;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void tsnet_timer_init(struct tsnet_timer_wheel *wheel, uint64_t now)
+{
+	memset(wheel, 0x00, sizeof(struct tsnet_timer_wheel));
+	wheel->now = now;
+}
+
+void tsnet_timer_clear(struct tsnet_timer_wheel *wheel)
+{
+	struct tsnet_timer *timer;
+
+	for ( int level = 0; level < TSNET_TIMER_LEVELS; level++ ) {
+		for ( int slot = 0; slot < TSNET_TIMER_SLOTS; slot++ ) {
+			while ( (timer = wheel->slots[level][slot]) ) {
+				wheel->slots[level][slot] = timer->next;
+				free(timer);
+			}
+		}
+	}
+
+	while ( (timer = wheel->free_list) ) {
+		wheel->free_list = timer->next;
+		free(timer);
+	}
+
+	tsnet_timer_init(wheel, wheel->now);
+}
+
+static void link_timer(struct tsnet_timer_wheel *wheel, struct tsnet_timer *timer)
+{
+	int level;
+	uint64_t delta = timer->expire - wheel->now;
+
+	// a level covers 2^(8 * (level + 1)) ticks, the slot is taken from the absolute expire time
+	for ( level = 0; level < TSNET_TIMER_LEVELS - 1 && delta >= 1ULL << (TSNET_TIMER_SLOT_BITS * (level + 1)); level++ ) {/* no action */}
+
+	timer->level = level;
+	timer->slot = (timer->expire >> (TSNET_TIMER_SLOT_BITS * level)) & TSNET_TIMER_SLOT_MASK;
+
+	if ( (timer->next = wheel->slots[level][timer->slot]) ) timer->next->pprev = &timer->next;
+	timer->pprev = &wheel->slots[level][timer->slot];
+	wheel->slots[level][timer->slot] = timer;
+
+	wheel->bitmap[level][timer->slot >> 6] |= 1ULL << (timer->slot & 63);
+}
+
+static void unlink_timer(struct tsnet_timer_wheel *wheel, struct tsnet_timer *timer)
+{
+	if ( (*timer->pprev = timer->next) ) timer->next->pprev = timer->pprev;
+
+	if ( !wheel->slots[timer->level][timer->slot] ) wheel->bitmap[timer->level][timer->slot >> 6] &= ~(1ULL << (timer->slot & 63));
+}
+
+struct tsnet_timer * tsnet_timer_start(struct tsnet_timer_wheel *wheel, uint64_t expire, tsnet_timer_cb_t cb, void *arg)
+{
+	struct tsnet_timer *timer;
+
+	if ( (timer = wheel->free_list) ) wheel->free_list = timer->next;
+	else if ( !(timer = malloc(sizeof(struct tsnet_timer))) ) {
+		TSNET_SET_ERROR("malloc() is failed: (errmsg: %s, errno: %d, size: %lu)", strerror(errno), errno, sizeof(struct tsnet_timer));
+		return NULL;
+	}
+
+	// a past time fires on the next tick, a too far one is cut to the wheel range
+	if ( expire <= wheel->now ) expire = wheel->now + 1;
+	if ( expire - wheel->now > TSNET_TIMER_MAX ) expire = wheel->now + TSNET_TIMER_MAX;
+
+	timer->expire = expire;
+	timer->cb = cb;
+	timer->arg = arg;
+
+	link_timer(wheel, timer);
+	wheel->count++;
+
+	return timer;
+}
+
+void tsnet_timer_stop(struct tsnet_timer_wheel *wheel, struct tsnet_timer *timer)
+{
+	unlink_timer(wheel, timer);
+	wheel->count--;
+
+	timer->next = wheel->free_list;
+	wheel->free_list = timer;
+}
+
+/* first non-empty slot after slot (circular), 0 when the level is empty */
+static int next_slot_distance(struct tsnet_timer_wheel *wheel, int level, int slot)
+{
+	for ( int d = 1; d <= TSNET_TIMER_SLOTS; ) {
+		int i = (slot + d) & TSNET_TIMER_SLOT_MASK;
+		uint64_t bits = wheel->bitmap[level][i >> 6] >> (i & 63);
+
+		if ( bits ) return d + __builtin_ctzll(bits);
+
+		d += 64 - (i & 63); // to the next bitmap word
+	}
+
+	return 0;
+}
+
+/* move the timers of a higher level slot down, they expire within its range now */
+static void cascade(struct tsnet_timer_wheel *wheel, int level)
+{
+	int slot = (wheel->now >> (TSNET_TIMER_SLOT_BITS * level)) & TSNET_TIMER_SLOT_MASK;
+	struct tsnet_timer *timer;
+
+	if ( level + 1 < TSNET_TIMER_LEVELS && slot == 0 ) cascade(wheel, level + 1);
+
+	while ( (timer = wheel->slots[level][slot]) ) {
+		unlink_timer(wheel, timer);
+		link_timer(wheel, timer);
+	}
+}
+
+void tsnet_timer_advance(TSNET *tsnet, struct tsnet_timer_wheel *wheel, uint64_t now)
+{
+	struct tsnet_timer *timer;
+
+	while ( wheel->now < now ) {
+		int slot = wheel->now & TSNET_TIMER_SLOT_MASK;
+		int d = next_slot_distance(wheel, 0, slot);
+		uint64_t tick;
+
+		if ( wheel->count == 0 ) { // nothing to run, jump
+			wheel->now = now;
+			break;
+		}
+
+		// skip to the next tick with work: a level 0 slot with timers or a level boundary (cascade)
+		tick = (wheel->now | TSNET_TIMER_SLOT_MASK) + 1;
+		if ( d && slot + d < TSNET_TIMER_SLOTS ) tick = wheel->now + d;
+
+		if ( tick > now ) {
+			wheel->now = now;
+			break;
+		}
+
+		wheel->now = tick;
+		slot = tick & TSNET_TIMER_SLOT_MASK;
+
+		if ( slot == 0 ) cascade(wheel, 1);
+
+		// a callback may start or stop timers, so take one at a time
+		while ( (timer = wheel->slots[0][slot]) ) {
+			tsnet_timer_cb_t cb = timer->cb;
+			void *arg = timer->arg;
+
+			tsnet_timer_stop(wheel, timer); // the handle is invalid in the callback
+			cb(tsnet, arg);
+		}
+	}
+}
+
+/* epoll_wait() timeout (ms) until the next tick with work, -1 when no timer is armed */
+int tsnet_timer_timeout(struct tsnet_timer_wheel *wheel, uint64_t now)
+{
+	uint64_t next = UINT64_MAX;
+
+	if ( wheel->count == 0 ) return -1;
+
+	for ( int level = 0; level < TSNET_TIMER_LEVELS; level++ ) {
+		int shift = TSNET_TIMER_SLOT_BITS * level;
+		int d = next_slot_distance(wheel, level, (wheel->now >> shift) & TSNET_TIMER_SLOT_MASK);
+		uint64_t tick;
+
+		if ( !d ) continue;
+
+		// level 0: the expire time itself, upper levels: when the slot is cascaded
+		tick = ((wheel->now >> shift) + d) << shift;
+		if ( tick < next ) next = tick;
+	}
+
+	if ( next <= now ) return 0;
+
+	return next - now > INT_MAX ? INT_MAX : (int)(next - now);
+}
@@ -0,0 +1,16 @@
+#include "tsnet.h"
+#include "tsnet_common_inter.h"
+
+/* hierarchical timer wheel: 1ms ticks, TSNET_TIMER_LEVELS levels of TSNET_TIMER_SLOTS slots (2^32 ms ~ 49 days) */
+#define TSNET_TIMER_SLOT_BITS 8 /* log2(TSNET_TIMER_SLOTS) */
+#define TSNET_TIMER_SLOT_MASK (TSNET_TIMER_SLOTS - 1)
+#define TSNET_TIMER_MAX ((1ULL << (TSNET_TIMER_SLOT_BITS * TSNET_TIMER_LEVELS)) - 1) /* longer timeouts are cut to this */
+
+uint64_t tsnet_timer_clock(void);
+void tsnet_timer_init(struct tsnet_timer_wheel *wheel, uint64_t now);
+void tsnet_timer_clear(struct tsnet_timer_wheel *wheel);
+
+struct tsnet_timer * tsnet_timer_start(struct tsnet_timer_wheel *wheel, uint64_t expire, tsnet_timer_cb_t cb, void *arg);
+void tsnet_timer_stop(struct tsnet_timer_wheel *wheel, struct tsnet_timer *timer);
+void tsnet_timer_advance(TSNET *tsnet, struct tsnet_timer_wheel *wheel, uint64_t now);
+int tsnet_timer_timeout(struct tsnet_timer_wheel *wheel, uint64_t now);